@@ -57,6 +57,8 @@ class NabbitArray2DBase {
   ~NabbitArray2DBase();
 
   inline T* get_data() { return data; }
+  // The number of bytes of data the array uses.
+  inline ArrayLargeDim get_total_size() { return total_size; }
 };
 
 
@@ -98,6 +98,9 @@ class NabbitArray2DMorton: public NabbitArray2DBase<T> {
   
   inline void set(ArrayDim i, ArrayDim j, T val);
 
+  // Address of element (i, j), e.g., for prefetching.
+  inline T* get_ptr(ArrayDim i, ArrayDim j);
+
 
 
   // Access the array via iterators.  Iterators are Morton-order
@@ -192,6 +195,12 @@ T NabbitArray2DMorton<T, PAD_LEVEL, M_PADDING>::get(ArrayDim i,
   return this->data[ArrayMortonIndex(MortonIndexing::get_idx(i, j))];
 }
 
+template <class T, uint8_t PAD_LEVEL, int M_PADDING>
+T* NabbitArray2DMorton<T, PAD_LEVEL, M_PADDING>::get_ptr(ArrayDim i,
+							 ArrayDim j) {
+  return &this->data[ArrayMortonIndex(MortonIndexing::get_idx(i, j))];
+}
+
 template <class T, uint8_t PAD_LEVEL, int M_PADDING>
 void NabbitArray2DMorton<T, PAD_LEVEL, M_PADDING>::set(ArrayDim i,
 						       ArrayDim j,
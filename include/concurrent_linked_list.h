@@ -28,6 +28,8 @@
 #ifndef __CONCURRENT_LINKED_LIST_H
 #define __CONCURRENT_LINKED_LIST_H
 
+#include "nabbit_slab_allocator.h"
+
 /*************************************************
  * Implementing a simple concurrent linked list.
  * 
@@ -73,11 +75,16 @@ struct ListNode {
   
   ListNode(long long k, void* val, ListNode* nxt) :
     hashkey(k), next(nxt), status(VALID), value(val) { }  
+
+  NABBIT_SLAB_ALLOCATED
 };
 
 class ConcurrentLinkedList
 {
 
+ public:
+  NABBIT_SLAB_ALLOCATED
+
  private:
   ListNode* head;
 
@@ -33,6 +33,18 @@
 #define GET_WORKER_ID __cilkrts_get_worker_number()
 // #define GET_WORKER_ID -999
 
+#define NABBIT_CACHE_LINE_SIZE 64
+
+// Nodes with more than this many successors (or, for dynamic nodes,
+// predecessors) split the range in half recursively, instead of
+// spawning one child per edge in a serial loop.
+#ifndef NABBIT_SPAWN_GRAIN
+#define NABBIT_SPAWN_GRAIN 32
+#endif
+#if NABBIT_SPAWN_GRAIN < 1
+#error "NABBIT_SPAWN_GRAIN must be at least 1"
+#endif
+
 // Possible status for a node.
 typedef enum { NODE_UNVISITED=0,
 	       NODE_VISITED=1,
@@ -0,0 +1,255 @@
+// Code for the Nabbit task graph library
+//
+// Copyright (c) 2010 Jim Sukha
+//
+//
+/*
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use, copy,
+ * modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+
+#ifndef __DIRECT_TASK_TABLE_H_
+#define __DIRECT_TASK_TABLE_H_
+
+/**
+ * A task table for dynamic Nabbit, for DAGs whose keys are integers
+ * in a known range [min_key, max_key] (e.g., dense indices or Morton
+ * codes).
+ *
+ * Instead of hashing, the table is an array with one node pointer
+ * for every key in the range, so looking up a task is a single load.
+ * The array is reserved with mmap, but the kernel only commits a page
+ * of it the first time that page is written, so a large range with
+ * few tasks stays cheap.
+ *
+ * Tasks are created on demand.  Subclasses implement CreateTask(key),
+ * which constructs the node for a key.  To insert a task, we create
+ * it, mark it as visited, and then try to CAS it into its slot.  The
+ * thread whose CAS succeeds owns the task; a thread which loses
+ * deletes its copy.  Since every installed node is already visited,
+ * a non-NULL slot means the task exists.
+ *
+ * The table owns the nodes it creates, and deletes them when it is
+ * destroyed.  CreateTask() can allocate them from the table's slabs
+ * with "new (get_slab()) NodeType(...)".  Each worker records the
+ * keys of the nodes it installs, so the destructor only visits
+ * those, instead of the whole range.
+ */
+
+#include <assert.h>
+#include <stdio.h>
+#include <sys/mman.h>
+
+#include <dag_status.h>
+#include <dynamic_array.h>
+#include <task_graph_hash_table.h>
+#include <nabbit_epoch_reclaimer.h>
+
+
+template <class NodeType>
+class DirectTaskGraphTable: public TaskGraphHashTable {
+
+ public:
+  DirectTaskGraphTable(long long min_key, long long max_key);
+  virtual ~DirectTaskGraphTable();
+
+  void* get_task(long long key);
+  int insert_task_if_absent(long long key);
+  void* get_or_insert_task(long long key, int* inserted);
+  void remove_task(long long key);
+
+  long long get_min_key() { return min_key; }
+  long long get_max_key() { return max_key; }
+
+ protected:
+  // Creates (but does not insert) the node for key.
+  virtual NodeType* CreateTask(long long key) = 0;
+
+ private:
+  long long min_key;
+  long long max_key;
+  size_t num_bytes;
+  NodeType* volatile* slots;
+
+  // installed[p] holds the keys of the nodes worker p installed.
+  // installed[P] is shared by threads which are not Cilk workers.
+  int P;
+  DynamicArray<long long>** installed;
+
+  inline NodeType* volatile* slot_for_key(long long key);
+  inline void record_installed(long long key);
+
+  // Creates a node for key, and tries to install it.  Returns the
+  // node in the slot afterwards, and sets *inserted if it is ours.
+  NodeType* try_install(long long key, int* inserted);
+};
+
+
+template <class NodeType>
+DirectTaskGraphTable<NodeType>::DirectTaskGraphTable(long long min_key_,
+						     long long max_key_)
+  : min_key(min_key_),
+    max_key(max_key_),
+    num_bytes(0),
+    slots(NULL),
+    P(__cilkrts_get_nworkers()),
+    installed(NULL) {
+  assert(max_key >= min_key);
+
+  // Compute the number of keys without overflowing: the difference
+  // of two long longs may not fit in one, and the array size may not
+  // fit in a size_t.
+  unsigned long long num_keys = (unsigned long long)max_key - (unsigned long long)min_key + 1;
+  if ((num_keys == 0) ||
+      (num_keys > ((size_t)-1) / sizeof(NodeType*))) {
+    printf("ERROR: DirectTaskGraphTable key range [%lld, %lld] is too large\n",
+	   min_key, max_key);
+    assert(0);
+  }
+  num_bytes = (size_t)num_keys * sizeof(NodeType*);
+
+  // MAP_NORESERVE: do not reserve swap for the whole range, since
+  // most of it may never be touched.  Anonymous pages start out
+  // zeroed, i.e., every slot starts as NULL.
+  void* mem = mmap(NULL,
+		   num_bytes,
+		   PROT_READ | PROT_WRITE,
+		   MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE,
+		   -1,
+		   0);
+  if (mem == MAP_FAILED) {
+    printf("ERROR: DirectTaskGraphTable could not reserve %zu bytes for keys [%lld, %lld]\n",
+	   num_bytes, min_key, max_key);
+    assert(0);
+  }
+  slots = (NodeType* volatile*)mem;
+
+  installed = new DynamicArray<long long>*[P+1];
+  for (int p = 0; p <= P; p++) {
+    installed[p] = new (this->get_slab()) DynamicArray<long long>(16, this->get_slab());
+  }
+}
+
+template <class NodeType>
+DirectTaskGraphTable<NodeType>::~DirectTaskGraphTable() {
+  // Let the reclaimer finish deleting nodes first, so we do not
+  // delete them again.
+  if (this->reclaimer) {
+    this->reclaimer->drain();
+  }
+
+  // A reclaimed node has already cleared its slot.  Clearing the
+  // slots we delete means a key installed twice (after its first
+  // node was reclaimed) is only deleted once.
+  for (int p = 0; p <= P; p++) {
+    for (int i = 0; i < installed[p]->size_estimate(); i++) {
+      NodeType* volatile* slot = slot_for_key(installed[p]->get(i));
+      if (*slot != NULL) {
+	delete *slot;
+	*slot = NULL;
+      }
+    }
+    delete installed[p];
+  }
+  delete[] installed;
+  munmap((void*)slots, num_bytes);
+}
+
+
+template <class NodeType>
+NodeType* volatile* DirectTaskGraphTable<NodeType>::slot_for_key(long long key) {
+  if ((key < min_key) || (key > max_key)) {
+    printf("ERROR: key %lld is outside of the table range [%lld, %lld]\n",
+	   key, min_key, max_key);
+    assert(0);
+  }
+  return &slots[key - min_key];
+}
+
+
+template <class NodeType>
+void DirectTaskGraphTable<NodeType>::record_installed(long long key) {
+  int p = GET_WORKER_ID;
+  if ((p >= 0) && (p < P)) {
+    installed[p]->add(key);
+  }
+  else {
+    bool valid = installed[P]->try_atomic_add(key);
+    assert(valid);
+  }
+}
+
+
+template <class NodeType>
+NodeType* DirectTaskGraphTable<NodeType>::try_install(long long key,
+						      int* inserted) {
+  NodeType* volatile* slot = slot_for_key(key);
+  NodeType* n = CreateTask(key);
+  assert(n != NULL);
+  bool valid = n->try_mark_as_visited();
+  assert(valid);
+
+  if (__sync_bool_compare_and_swap(slot, (NodeType*)NULL, n)) {
+    record_installed(key);
+    *inserted = 1;
+    return n;
+  }
+
+  // Someone else installed a node first.
+  delete n;
+  *inserted = 0;
+  return *slot;
+}
+
+
+template <class NodeType>
+void* DirectTaskGraphTable<NodeType>::get_task(long long key) {
+  return (void*)(*slot_for_key(key));
+}
+
+template <class NodeType>
+int DirectTaskGraphTable<NodeType>::insert_task_if_absent(long long key) {
+  int inserted = 0;
+  if (*slot_for_key(key) == NULL) {
+    try_install(key, &inserted);
+  }
+  return inserted;
+}
+
+template <class NodeType>
+void* DirectTaskGraphTable<NodeType>::get_or_insert_task(long long key,
+							 int* inserted) {
+  NodeType* n = *slot_for_key(key);
+  *inserted = 0;
+  if (n == NULL) {
+    n = try_install(key, inserted);
+  }
+  return (void*)n;
+}
+
+// A reclaimed node is being deleted, so forget about it.
+template <class NodeType>
+void DirectTaskGraphTable<NodeType>::remove_task(long long key) {
+  *slot_for_key(key) = NULL;
+}
+
+
+#endif
@@ -33,47 +33,78 @@
  * An implementation of a simple concurrent dynamic array, which
  * supports insertions at the end of the array.
  *
- * When the array gets filled, it doubles in size (serially).
+ * The array is stored as a sequence of segments, where segment k
+ * holds c * 2^k elements, and c is the initial capacity rounded up
+ * to a power of 2.  When the array fills, the next segment is
+ * allocated and installed with a compare-and-swap; existing elements
+ * are never copied or moved.
  *
- * The array is optimized for inserts; a "get" must wait until any
- * previous inserts complete before it can continue.
+ * Each slot has its own ready flag.  A "get" only waits for the
+ * insert into the slot it is reading to complete.
  */
 
 // #include <cilk_mutex.h>
 #include <dag_status.h>
+#include <nabbit_slab_allocator.h>
+#include <new>
 #include <stdio.h>
 
-#define PRINT_LOCK_ACQUIRE_TRACE 0
+// Enough segments for any non-negative int index.
+#define DYNAMIC_ARRAY_MAX_SEGMENTS 32
 
 template <class T>
-struct DynamicArrayBuffer {
+struct DynamicArraySegment {
   T* a;
+  volatile char* ready;
   int capacity;
-  DynamicArrayBuffer<T>* next;
+
+  NABBIT_SLAB_ALLOCATED
 };
 
+// Element buffers come from the slab allocator (pool, or the default
+// allocator if pool is NULL), so we construct and destroy the
+// elements ourselves.
 template <class T>
-void dynarray_print_item(T* val);
-
-void dynarray_print_item(int* val) {
-  printf("%d", *val);
+T* dynamic_array_alloc_buffer(int capacity, NabbitSlabAllocator* pool) {
+  T* buf = (T*)nabbit_slab_alloc(capacity * sizeof(T), pool);
+  assert(buf != NULL);
+  for (int i = 0; i < capacity; i++) {
+    new (&buf[i]) T();
+  }
+  return buf;
 }
 
 template <class T>
-void dynamic_array_buffer_print(DynamicArrayBuffer<T>* buf) {
-  printf("DynArrayBuffer %p: ", buf);
-  if (buf != NULL) {
-    printf("cap = %d, next = %p, a = %p: [",
-	   buf->capacity,
-	   buf->next,
-	   buf->a);
-
-    for (int i = 0; i < buf->capacity; i++) {
-      //      dynarray_print_item(&buf->a[i]);
-      //      printf(", ");
-    }
-    printf("]");
+void dynamic_array_free_buffer(T* buf, int capacity) {
+  for (int i = 0; i < capacity; i++) {
+    buf[i].~T();
   }
+  nabbit_slab_free((void*)buf, capacity * sizeof(T));
+}
+
+template <class T>
+DynamicArraySegment<T>* dynamic_array_alloc_segment(int capacity,
+						    NabbitSlabAllocator* pool) {
+  DynamicArraySegment<T>* seg = new (pool) DynamicArraySegment<T>;
+  assert(seg != NULL);
+  seg->a = dynamic_array_alloc_buffer<T>(capacity, pool);
+  seg->ready = dynamic_array_alloc_buffer<char>(capacity, pool);
+  seg->capacity = capacity;
+  return seg;
+}
+
+template <class T>
+void dynamic_array_free_segment(DynamicArraySegment<T>* seg) {
+  dynamic_array_free_buffer<T>(seg->a, seg->capacity);
+  dynamic_array_free_buffer<char>((char*)seg->ready, seg->capacity);
+  delete seg;
+}
+
+template <class T>
+void dynarray_print_item(T* val);
+
+void dynarray_print_item(int* val) {
+  printf("%d", *val);
 }
 
 
@@ -81,34 +112,40 @@ template <class T>
 class DynamicArray {
 
  private:
-  T* a;
-  volatile int capacity;
+  DynamicArraySegment<T>* volatile segments[DYNAMIC_ARRAY_MAX_SEGMENTS];
+  // log2 of the capacity of segment 0.
+  int base_shift;
+  // Where the segments come from (NULL for the default allocator).
+  NabbitSlabAllocator* pool;
   volatile int current_size;
-  volatile int inserted_elements;
-  volatile int resize_lock;
-  //  cilk::mutex test_resize_mutex;
-  DynamicArrayBuffer<T>* old_arrays;
 
-  bool try_acquire_resize_lock();
-  void release_resize_lock();
+  // Maps an index to a segment and an offset within that segment.
+  inline int segment_of(int idx, int* offset);
 
-  // Doubles the size of the array  
-  void resize_array_grow();
+  // Returns segment k, allocating it if it does not exist yet.
+  DynamicArraySegment<T>* get_or_create_segment(int k);
 
-  
+  // Returns segment k, waiting for the insert which allocates it.
+  DynamicArraySegment<T>* wait_for_segment(int k);
+
+  // Writes val into the slot idx, which the caller has reserved.
+  void store_slot(int idx, T val);
   
  public:
   
-  DynamicArray(int init_capacity);
+  // Segments come from pool, if it is not NULL.  An array which
+  // belongs to a task graph should pass the graph's
+  // TaskGraphHashTable::get_slab(), and be deleted before the table.
+  DynamicArray(int init_capacity, NabbitSlabAllocator* pool = NULL);
   ~DynamicArray();
 
+  NABBIT_SLAB_ALLOCATED
+
   void print();
 
   int size_estimate();
 
-  // Get is not necessarily a constant time operation;
-  // In our implementation, it must wait for any inserts which start before
-  // this get operation to complete.
+  // Get waits only for the insert into slot idx to complete.
   T get(int idx);
 
   T get_with_print(int idx);
@@ -120,68 +157,64 @@ class DynamicArray {
 
 
 template <class T>
-DynamicArray<T>::DynamicArray(int init_capacity) {
+DynamicArray<T>::DynamicArray(int init_capacity, NabbitSlabAllocator* pool_)
+  : pool(pool_) {
 
   assert(init_capacity > 0);
-  this->capacity = init_capacity;
+  this->base_shift = 0;
+  while ((1 << this->base_shift) < init_capacity) {
+    this->base_shift++;
+  }
   this->current_size = 0;
-  this->inserted_elements = 0;
-  this->a = new T[init_capacity];
-  this->resize_lock = 0;
-  this->old_arrays = NULL;
+  for (int k = 0; k < DYNAMIC_ARRAY_MAX_SEGMENTS; k++) {
+    this->segments[k] = NULL;
+  }
+  this->segments[0] = dynamic_array_alloc_segment<T>(1 << this->base_shift,
+						     this->pool);
 }
 
 template <class T>
 DynamicArray<T>::~DynamicArray() {
-
-  DynamicArrayBuffer<T>* current_old_arrays = this->old_arrays;
-
-  while (current_old_arrays != NULL) {
-    this->old_arrays = this->old_arrays->next;
-    printf("Deleting old array %p, capacity = %d\n",
-	   current_old_arrays->a,
-	   current_old_arrays->capacity);
-
-    delete[] current_old_arrays->a;
-    current_old_arrays = this->old_arrays;
+  for (int k = 0; k < DYNAMIC_ARRAY_MAX_SEGMENTS; k++) {
+    if (this->segments[k] != NULL) {
+      dynamic_array_free_segment<T>(this->segments[k]);
+      this->segments[k] = NULL;
+    }
   }
-  
-  delete[] this->a;
 }
 
 
 template <class T>
 int DynamicArray<T>::size_estimate() {
-  return current_size;
+  return __atomic_load_n(&this->current_size, __ATOMIC_ACQUIRE);
 }
 
 template <class T>
 void DynamicArray<T>::print() {
   printf("*******************\n");
   printf("DynamicArray %p: ", this);
-  printf("current_size = %d, inserted_elements = %d, capacity = %d, ",
+  printf("current_size = %d, base capacity = %d\n",
 	 this->current_size,
-	 this->inserted_elements,
-	 this->capacity);
-  printf("a = %p\n", this->a);
-
+	 1 << this->base_shift);
 
   bool print_elems = true;
 
   if (print_elems) {
     printf("Elements = [");
     for (int i = 0; i < this->current_size; i++) {
-      dynarray_print_item(&this->a[i]);
+      T val = this->get(i);
+      dynarray_print_item(&val);
       printf(", ");
     }
     printf("]\n");
-    printf("old_arrays = %p:\n",
-	   this->old_arrays);
 
-    DynamicArrayBuffer<T>* old_arrays = this->old_arrays;
-    while (old_arrays != NULL) {
-      dynamic_array_buffer_print(old_arrays);
-      old_arrays = old_arrays->next;
+    for (int k = 0; k < DYNAMIC_ARRAY_MAX_SEGMENTS; k++) {
+      if (this->segments[k] != NULL) {
+	printf("Segment %d: cap = %d, a = %p\n",
+	       k,
+	       this->segments[k]->capacity,
+	       this->segments[k]->a);
+      }
     }
   }
   printf("*******************\n");
@@ -189,44 +222,77 @@ void DynamicArray<T>::print() {
 
 
 template <class T>
-bool DynamicArray<T>::try_acquire_resize_lock() {
+inline int DynamicArray<T>::segment_of(int idx, int* offset) {
+  // Segment k starts at index (2^k - 1) * 2^base_shift.
+  unsigned int q = ((unsigned int)idx >> this->base_shift) + 1;
+  int k = 31 - __builtin_clz(q);
+  *offset = idx - (((1 << k) - 1) << this->base_shift);
+  return k;
+}
 
-  int worker_id = 1;
 
-  volatile bool acquired = false;
-  int retry_count = 0;
-  while ((!acquired) && (retry_count < 10)) {
-    acquired = __sync_bool_compare_and_swap(&this->resize_lock,
-					    0,
-					    worker_id);
-    retry_count++;
+template <class T>
+DynamicArraySegment<T>* DynamicArray<T>::get_or_create_segment(int k) {
+  // The acquire load pairs with the CAS which installed the segment,
+  // so we see its fields.
+  DynamicArraySegment<T>* seg = __atomic_load_n(&this->segments[k], __ATOMIC_ACQUIRE);
+  if (seg == NULL) {
+    DynamicArraySegment<T>* new_seg =
+      dynamic_array_alloc_segment<T>(1 << (this->base_shift + k), this->pool);
+
+    // If another insert installed the segment first, use theirs.
+    if (__sync_bool_compare_and_swap(&this->segments[k],
+				     (DynamicArraySegment<T>*)NULL,
+				     new_seg)) {
+      seg = new_seg;
+    }
+    else {
+      dynamic_array_free_segment<T>(new_seg);
+      seg = __atomic_load_n(&this->segments[k], __ATOMIC_ACQUIRE);
+    }
   }
-  return acquired;
+  return seg;
 }
 
+
 template <class T>
-void DynamicArray<T>::release_resize_lock() {
+DynamicArraySegment<T>* DynamicArray<T>::wait_for_segment(int k) {
+  DynamicArraySegment<T>* seg = __atomic_load_n(&this->segments[k], __ATOMIC_ACQUIRE);
+  while (seg == NULL) {
+    seg = __atomic_load_n(&this->segments[k], __ATOMIC_ACQUIRE);
+  }
+  return seg;
+}
+
 
-  assert(this->resize_lock > 0);
-  __sync_lock_release(&this->resize_lock);
+template <class T>
+void DynamicArray<T>::store_slot(int idx, T val) {
+  int offset;
+  int k = this->segment_of(idx, &offset);
+  assert(k < DYNAMIC_ARRAY_MAX_SEGMENTS);
+  DynamicArraySegment<T>* seg = this->get_or_create_segment(k);
+
+  seg->a[offset] = val;
+  // The release store publishes the element along with its flag.
+  __atomic_store_n(&seg->ready[offset], 1, __ATOMIC_RELEASE);
 }
 
 
 template <class T>
 T DynamicArray<T>::get(int idx) {
-  if ((idx >= 0) && (idx < this->current_size)) {
+  if ((idx >= 0) && (idx < this->size_estimate())) {
 
-    // Spin waiting for the inserted_element count to catch up to
-    // number of elements we have inserted.
-    // 
-    // In theory, this "get" function can wait a long time if inserts
-    // keep changing the size of the array.
+    // The slot has been reserved, but the insert may not have
+    // finished yet.  Spin until this slot (and only this slot) is
+    // ready.
+    int offset;
+    int k = this->segment_of(idx, &offset);
+    DynamicArraySegment<T>* seg = this->wait_for_segment(k);
 
-    int spin_count = 0;
-    while (this->inserted_elements < this->current_size) {
-      spin_count++;
+    // The acquire load pairs with the release store in store_slot().
+    while (!__atomic_load_n(&seg->ready[offset], __ATOMIC_ACQUIRE)) {
     }
-    return a[idx];
+    return seg->a[offset];
   } else {
     return NULL;
   }
@@ -235,218 +301,63 @@ T DynamicArray<T>::get(int idx) {
 
 template <class T>
 T DynamicArray<T>::get_with_print(int idx) {
-  if ((idx >= 0) && (idx < this->current_size)) {
+  if ((idx >= 0) && (idx < this->size_estimate())) {
 
+    int offset;
+    int k = this->segment_of(idx, &offset);
+    printf("Searching for idx %d, segment %d, offset %d\n",
+	   idx, k, offset);
+    DynamicArraySegment<T>* seg = this->wait_for_segment(k);
 
-    printf("Searching for idx %d, array a = %p\n",
-	   idx, a);
-    // Spin waiting for the inserted_element count to catch up to the
-    // index slot we are looking at.
-    while (this->inserted_elements < idx) {
-      printf("SPIN waiting for idx = %d, element_count = %d\n",
-	     idx, this->inserted_elements);
+    while (!__atomic_load_n(&seg->ready[offset], __ATOMIC_ACQUIRE)) {
+      printf("SPIN waiting for idx = %d, size = %d\n",
+	     idx, this->current_size);
     }
 
-    __sync_synchronize();
-
 
     printf("Returning value %d\n",
-	   a[idx]);
-    return a[idx];
+	   seg->a[offset]);
+    return seg->a[offset];
   } else {
     return NULL;
   }
 }
 
 
-// This method is not thread-safe yet, even though it acquires a lock.
-// The problem is, no lock is held while elements are being inserted.
-// So it could be that we copy over garbage values when we are doing
-// the copy-over.
-//
-// Also, we might free the original array after an insert has acquired
-// a slot, but before it finishes its insert.
-// 
-// So we need a "valid" bit to make sure the elements we are copying
-// over are valid?  Or we could have a "reader lock" on the entire
-// array when we are doing inserts.
-//
-// 
-// 
-template <class T>
-void DynamicArray<T>::resize_array_grow() {
-  T* old_array = a;
-  volatile bool got_lock = false;
-
-  //  while (!got_lock) {
-
-  if (this->current_size >= this->capacity) {    
-    got_lock = this->try_acquire_resize_lock();
-  }
-
-  if (!got_lock) {
-    return;
-  }
-
-  //  __sync_synchronize();
-
-  //  }
-
-
-  if (PRINT_LOCK_ACQUIRE_TRACE) {
-    printf("Worker %d Acquired the lock here. size = %d, inserted_elements = %d, capacity = %d\n",
-	   GET_WORKER_ID, // cilk::current_worker_id(),
-	   this->current_size,
-	   this->inserted_elements,
-	   this->capacity);
-  }
-  assert(got_lock);
-  assert(this->resize_lock > 0);
-
-
-  // We might get the lock even though we don't need to resize.  In
-  // this case, there is no need to resize, and we can release the
-  // lock.
-  if (this->current_size < this->capacity) {
-    if (PRINT_LOCK_ACQUIRE_TRACE) {
-      printf("Worker %d Release lock for unneeded resize... current size = %d, current cap = %d\n",
-	     GET_WORKER_ID, // cilk::current_worker_id(),
-	     this->current_size,
-	     this->capacity);
-    }
-    this->release_resize_lock();
-    return;
-  }
-  
-  
-  int new_capacity = this->capacity * 2;
-
-  T* new_buffer = new T[new_capacity];
-  assert(new_buffer != NULL);
-
-  //  this->a = new T[new_capacity];
-  //  assert(a != NULL);
-
-  // Push the old array onto the linked list of old arrays.
-  DynamicArrayBuffer<T>* old_array_buffer;
-  old_array_buffer = new DynamicArrayBuffer<T>;
-  assert(old_array_buffer != NULL);
-  old_array_buffer->a = old_array;
-  old_array_buffer->capacity = this->capacity;
-  old_array_buffer->next = this->old_arrays;
-  this->old_arrays = old_array_buffer;
-
-  // Check to see if outstanding inserts have finished.
-  volatile int wait_count = 0;
-  while (this->inserted_elements < this->capacity) {
-    wait_count++;
-    __sync_synchronize();
-  }
-  assert(this->current_size == this->inserted_elements);
-
-
-  // Now we know we can copy over all the elements.
-  for (int i = 0; i < this->current_size; i++) {
-    new_buffer[i] = old_array[i];
-  }
-  
-  
-  // Memory barrier to make sure things are copied out.
-  __sync_synchronize();
-
-
-  // Actually swing the pointer from the old array to the new array.
-  this->a = new_buffer;
-  __sync_synchronize();
-
-
-  // Update the capacity of the array. This update will allow more
-  // inserts to happen.
-  this->capacity = new_capacity;
-
-  if (PRINT_LOCK_ACQUIRE_TRACE) {
-    printf("Worker %d Release lock. current size = %d, current cap = %d\n",
-	   GET_WORKER_ID, // cilk::current_worker_id(),
-	   this->current_size,
-	   this->capacity);
-  }
-  this->release_resize_lock();
-
-  //delete[] old_array;
-}
-
-
 /**
  * Adds to the array without synchronization.  This method should be
  * called only when we know it is executing serially.
  */
 template <class T>
 void DynamicArray<T>::add(T val) {
-  int idx;
-  if (this->current_size >= this->capacity) {
-    this->resize_array_grow();
-  }
-  
-  assert(this->current_size < this->capacity);
-  idx = this->current_size;
+  int idx = this->current_size;
   this->current_size++;
-  a[idx] = val;
-  this->inserted_elements++;
+  this->store_slot(idx, val);
 }
 
 
 /**
- * Atomically adds to the end of the array.  Uses a compare-and-swap
- * for synchronization.
+ * Atomically adds to the end of the array.  Uses a fetch-and-add to
+ * reserve a slot.
  *
- * If the the array is full, it the operation will resize the array
- * first and then try to insert again.
+ * If the slot falls past the last allocated segment, the insert
+ * allocates the next segment.  Other inserts never wait for this
+ * allocation, and reads wait only if they read from the new segment.
  *
  * Returns true if insert succeeded, and false otherwise.
  */
 template <class T>
 bool DynamicArray<T>::try_atomic_add(T val) {
 
-  int idx = -1;
-  int retry_count = 0;
-
-  //bool __sync_bool_compare_and_swap (type *ptr, type oldval type newval, ...)
+  int idx = __sync_fetch_and_add(&this->current_size, 1);
 
-  // This first loop tries to reserve an index in the dynamic array
-  // for the new element.
-  
-  while ((idx < 0) && (retry_count < 10)) {
-    if (this->current_size >= this->capacity) {
-      this->resize_array_grow();
-    }
-    
-    volatile int temp_size = this->current_size;
-    if (temp_size < this->capacity) {
-      bool got_space = __sync_bool_compare_and_swap(&this->current_size,
-						    temp_size,
-						    temp_size+1);
-      if (got_space) {
-	idx = temp_size;
-      }
-    }
-    retry_count++;
-  }
-
-  // If idx is still -1, then we didn't get a slot.
+  // If idx is negative, the array has run out of int indices.
   if (idx < 0) {
     return false;
   }
 
-  // Otherwise, we have a slot.  Add our element.
-  a[idx] = val;
-
-  //  __sync_synchronize();
-
-  // Then, atomically update the inserted elements count.  This atomic
-  // increment should already be a full barrier.
-  __sync_fetch_and_add(&this->inserted_elements,
-		       1);
-  return true;  
+  this->store_slot(idx, val);
+  return true;
 }
 
 
@@ -30,7 +30,13 @@
 
 #include <dag_status.h>
 #include <dynamic_array.h>
+#include <nabbit_combining_counter.h>
+#include <nabbit_elastic.h>
+#include <nabbit_inline_array.h>
+#include <nabbit_node_layout.h>
+#include <nabbit_scratch_arena.h>
 #include <task_graph_hash_table.h>
+#include <nabbit_epoch_reclaimer.h>
 
 // Debugging flag.
 
@@ -40,8 +46,81 @@
 
 class DynamicNabbitNode;
 
-typedef DynamicArray<long long> DTGSKeyArray;
-typedef DynamicArray<DynamicNabbitNode*> DynamicNabbitNodeArray;
+typedef NabbitInlineArray<long long, NABBIT_INLINE_DEGREE> DTGSKeyArray;
+typedef NabbitInlineArray<DynamicNabbitNode*, NABBIT_INLINE_DEGREE> DynamicNabbitNodeArray;
+
+
+// One entry in the list of successors waiting on a node.  Successors
+// register by pushing a cell onto the head of the list with a CAS.
+//
+// A successor uses one of its own inline cells for each of its first
+// NABBIT_INLINE_DEGREE predecessors, and allocates cells from H's
+// slabs only for the rest.  Inline cells must never be deleted.
+//
+// pred_idx is the index of the predecessor in succ's list, which
+// picks the leaf to arrive at if succ uses a combining counter.
+struct DynamicNabbitSuccCell {
+  DynamicNabbitNode* succ;
+  DynamicNabbitSuccCell* next;
+  int pred_idx;
+  bool is_inline;
+
+  DynamicNabbitSuccCell()
+    : succ(NULL), next(NULL), pred_idx(0), is_inline(true) { }
+
+  DynamicNabbitSuccCell(DynamicNabbitNode* s, int idx)
+    : succ(s), next(NULL), pred_idx(idx), is_inline(false) { }
+
+  NABBIT_SLAB_ALLOCATED
+};
+
+// Marker stored in the head of the successor list once a node has
+// notified everyone.  A successor that finds this marker knows
+// its predecessor has finished and does not need to wait.
+#define DYNAMIC_NABBIT_SUCC_SEALED ((DynamicNabbitSuccCell*)0x1)
+
+
+// The status and join counter of a node share one 64-bit state word:
+// the status is in the low 32 bits, and the join counter in the high
+// 32 bits.  Adding or subtracting DYNAMIC_NABBIT_JOIN_ONE changes the
+// counter without touching the status, so a single fetch-and-add both
+// decrements the counter and tells us which status the node was in.
+#define DYNAMIC_NABBIT_JOIN_ONE (1LL << 32)
+#define DYNAMIC_NABBIT_STATUS_MASK (DYNAMIC_NABBIT_JOIN_ONE - 1)
+
+
+/**
+ * Reclaiming completed nodes.
+ *
+ * By default, every node stays in the hash table, with all its
+ * arrays, until the table is destroyed.  If the hash table has a
+ * NabbitEpochReclaimer (see TaskGraphHashTable::set_reclaimer), a
+ * node whose result is only read by its immediate successors can
+ * instead be reclaimed as soon as they are done with it.
+ *
+ * To opt in, a node calls set_successor_count(n) in its Init()
+ * method, where n is the number of nodes which will list it as a
+ * predecessor.  The node then counts references to itself:
+ *
+ *   1. The node holds a reference to itself until it is COMPLETED.
+ *   2. Each of the n successors holds a reference until its own
+ *      Compute() returns.
+ *
+ * When the count drops to 0, the node is marked as DEAD, and
+ * retired to the reclaimer.  Once no reader can still be using it,
+ * the reclaimer calls the node's Reclaim() method, where subclasses
+ * can free (or save) their own results, removes the node from the
+ * hash table (see TaskGraphHashTable::remove_task), and deletes it.
+ *
+ * The count must be exact: a successor which arrives after the node
+ * has been reclaimed would read freed memory.  Every lookup in the
+ * hash table runs inside a reclaimer critical section (enter() /
+ * exit()), so a node is never freed while a lookup may be reading
+ * it.  Code which reads other nodes outside of Compute() should do
+ * the same, and check for NODE_DEAD.
+ *
+ * Drain the reclaimer before destroying the hash table.
+ */
 
 
 class DynamicNabbitNode {
@@ -49,12 +128,15 @@ class DynamicNabbitNode {
  public:
   long long key; 
   TaskGraphHashTable* H;
+  // Points at pred_storage once the node is expanded.
   DTGSKeyArray* predecessors;
   
   // Constructors for a node.
   DynamicNabbitNode(long long k, TaskGraphHashTable* H);
   DynamicNabbitNode(long long k, TaskGraphHashTable* H, int num_succ);
-  ~DynamicNabbitNode();
+  virtual ~DynamicNabbitNode();
+
+  NABBIT_SLAB_ALLOCATED
 
   
   void add_dep(long long key);
@@ -69,32 +151,87 @@ class DynamicNabbitNode {
     
   virtual void Init() = 0;
   virtual void Compute() = 0;
+
+  // Called when this node is enabled, shortly before Compute() runs.
+  // Override to prefetch the inputs of Compute().
+  virtual void PrefetchInputs() { }
+
+  // Temporary memory for the current call to Compute().  It is freed
+  // automatically when Compute() returns.  Only call this from the
+  // Compute() strand itself (see nabbit_scratch_arena.h).
+  void* scratch(size_t bytes);
   virtual void Generate() = 0;
 
+  // Called when a DEAD node's memory is reclaimed.  Only used if the
+  // hash table has a reclaimer.
+  virtual void Reclaim() { }
 
+  // Called from Init(), to make this node reclaimable.
+  void set_successor_count(int num_succ);
 
- private:
-  DAGNodeStatus volatile status;
-  volatile int join_counter;
 
-  DynamicNabbitNodeArray* succ_to_notify;
+
+ private:
+  // Read-mostly fields come first, and scheduler state which other
+  // workers update comes last (see nabbit_node_layout.h).
   DTGSKeyArray* generated_tasks;
 
-  volatile int notify_counter; 
-  volatile int blocking_lock;
+  // Storage for the arrays above, and the cells this node uses to
+  // register with its first few predecessors, so low-degree nodes do
+  // not allocate them separately.
+  DTGSKeyArray pred_storage;
+  DTGSKeyArray generated_storage;
+  DynamicNabbitSuccCell succ_cells[NABBIT_INLINE_DEGREE];
+
+  // Only used if H->reclaimer is set.  pred_nodes[i] is the node
+  // for predecessors->get(i), which we hold a reference to.
+  bool counts_successors;
+  DynamicNabbitNode** pred_nodes;
+
+  // Only used if the node has more than NABBIT_COMBINING_THRESHOLD
+  // predecessors.  The join counter then counts the leaves of this
+  // counter instead of the predecessors (see
+  // nabbit_combining_counter.h).
+  NabbitCombiningCounter* combining;
+
+  // Only set while Compute() is running.
+  NabbitScratchArena* scratch_arena;
+
+  // Status and join counter (see DYNAMIC_NABBIT_JOIN_ONE).  Only
+  // accessed through __atomic builtins.
+  long long state NABBIT_CACHE_ALIGNED;
+  DynamicNabbitSuccCell* volatile succ_head;
+  // Only used if H->reclaimer is set.
+  volatile int ref_count;
+
+  static inline long long pack_state(DAGNodeStatus status, int join_counter);
+  static inline DAGNodeStatus state_status(long long st);
+  static inline int state_join_counter(long long st);
+  inline int join_counter();
+  inline bool try_change_status(DAGNodeStatus from, DAGNodeStatus to);
+  inline int decrement_join_counter(DAGNodeStatus* old_status);
+  inline int arrive_from_predecessor(int pred_idx, DAGNodeStatus* old_status);
+  void use_combining_counter();
 
   inline void mark_as_visited();
 
   inline void mark_as_expanded();
 
   inline void mark_as_computed();
-  inline bool try_mark_as_completed();
-  inline bool try_acquire_blocking_lock();
-  inline void acquire_blocking_lock();
-  inline void release_blocking_lock();
+  inline void mark_as_completed();
+
+  inline bool try_register_successor(DynamicNabbitSuccCell* cell);
+  inline DynamicNabbitSuccCell* try_detach_successors();
+
+  inline void release_ref();
+  inline size_t pred_nodes_bytes();
+  void release_predecessors();
+  static void reclaim_node(void* node);
+  inline void* lookup_task(long long key, int* inserted);
 
 
-  void try_init_pred_and_compute(long long pred_key); 
+  void try_init_pred_and_compute(long long pred_key, int pred_idx); 
+  void init_pred_range(int start, int end);
   void init_node_and_compute();
   void compute_and_notify();
 
@@ -102,24 +239,27 @@ class DynamicNabbitNode {
 
 
 
-// When constructing a DynamicNabbitNode, we need to initialize the blocking
-// array because when a new node n gets put into the hash table, other
-// nodes may block on n, and add themselves to this array, even though
-// n hasn't been expanded yet.
+// When constructing a DynamicNabbitNode, the successor list starts
+// out empty (and open) because when a new node n gets put into the
+// hash table, other nodes may block on n, and add themselves to this
+// list, even though n hasn't been expanded yet.
 DynamicNabbitNode::DynamicNabbitNode(long long k,
 				     TaskGraphHashTable* H_)
   :  key(k),
      H(H_),
      predecessors(NULL),
-     status(NODE_UNVISITED),
-     join_counter(1),
-     succ_to_notify(new DynamicNabbitNodeArray(4)),
-     generated_tasks(NULL),     
-     blocking_lock(0) {
+     generated_tasks(NULL),
+     counts_successors(false),
+     pred_nodes(NULL),
+     combining(NULL),
+     scratch_arena(NULL),
+     state(pack_state(NODE_UNVISITED, 1)),
+     succ_head(NULL),
+     ref_count(1) {
 }
 
-// The same as the previous construct, except we pass in a default
-// size for the blocking array.
+// The same as the previous constructor.  The successor list grows
+// one cell at a time, so the size hint is no longer needed.
 
 DynamicNabbitNode::DynamicNabbitNode(long long k,
 				     TaskGraphHashTable* H_,
@@ -127,137 +267,295 @@ DynamicNabbitNode::DynamicNabbitNode(long long k,
   :  key(k),
      H(H_),
      predecessors(NULL),
-     status(NODE_UNVISITED),
-     join_counter(1),
-     succ_to_notify(new DynamicNabbitNodeArray(num_succ)),
      generated_tasks(NULL),
-     blocking_lock(0) {
+     counts_successors(false),
+     pred_nodes(NULL),
+     combining(NULL),
+     scratch_arena(NULL),
+     state(pack_state(NODE_UNVISITED, 1)),
+     succ_head(NULL),
+     ref_count(1) {
 }
 
 
 DynamicNabbitNode::~DynamicNabbitNode() {
-  if (this->predecessors) {
-    delete this->predecessors;
+  if (this->pred_nodes) {
+    nabbit_slab_free(this->pred_nodes, this->pred_nodes_bytes());
+  }
+  if (this->combining) {
+    delete this->combining;
   }
-  if (this->succ_to_notify) {
-    delete this->succ_to_notify;
+
+  // A node which never completed may still have cells on its
+  // successor list.  We do not walk them: inline cells live in the
+  // successors, which may already be gone.  Allocated cells come
+  // from H's slabs, and are freed with the table.
+}
+
+
+// Pushes cell onto the successor list.  Returns false if the list
+// has already been sealed, i.e., this node has finished notifying
+// its successors and the caller should not wait for it.
+//
+// The CAS only fails if another successor registered or the list
+// was detached/sealed in the meantime, so some thread always makes
+// progress.
+bool DynamicNabbitNode::try_register_successor(DynamicNabbitSuccCell* cell) {
+  while (true) {
+    DynamicNabbitSuccCell* head = this->succ_head;
+    if (head == DYNAMIC_NABBIT_SUCC_SEALED) {
+      return false;
+    }
+    cell->next = head;
+    if (__sync_bool_compare_and_swap(&this->succ_head,
+				     head,
+				     cell)) {
+      return true;
+    }
   }
-  if (this->generated_tasks) {
-    delete this->generated_tasks;
+}
+
+// Called by the node itself after it is COMPUTED.  Removes and
+// returns the current batch of registered successors.  If there are
+// none, seals the list instead and returns NULL.  Returns
+// DYNAMIC_NABBIT_SUCC_SEALED once the list has been sealed.
+DynamicNabbitSuccCell* DynamicNabbitNode::try_detach_successors() {
+  while (true) {
+    DynamicNabbitSuccCell* head = this->succ_head;
+    assert(head != DYNAMIC_NABBIT_SUCC_SEALED);
+    if (head == NULL) {
+      if (__sync_bool_compare_and_swap(&this->succ_head,
+				       (DynamicNabbitSuccCell*)NULL,
+				       DYNAMIC_NABBIT_SUCC_SEALED)) {
+	return DYNAMIC_NABBIT_SUCC_SEALED;
+      }
+    }
+    else {
+      if (__sync_bool_compare_and_swap(&this->succ_head,
+				       head,
+				       (DynamicNabbitSuccCell*)NULL)) {
+	return head;
+      }
+    }
   }
 }
 
+long long DynamicNabbitNode::pack_state(DAGNodeStatus status,
+				       int join_counter) {
+  return ((long long)join_counter * DYNAMIC_NABBIT_JOIN_ONE) | (long long)status;
+}
 
-bool DynamicNabbitNode::try_acquire_blocking_lock() {
-  bool acquired = false;
-  acquired = __sync_bool_compare_and_swap(&this->blocking_lock,
-					  0,
-					  1);
-  return acquired;
+DAGNodeStatus DynamicNabbitNode::state_status(long long st) {
+  return (DAGNodeStatus)(st & DYNAMIC_NABBIT_STATUS_MASK);
 }
 
-void DynamicNabbitNode::acquire_blocking_lock() {
-  bool acquired = false;
-  while (!acquired) {
-    acquired = __sync_bool_compare_and_swap(&this->blocking_lock,
-					    0,
-					    1);
-  }      
+int DynamicNabbitNode::state_join_counter(long long st) {
+  return (int)(st >> 32);
 }
 
-void DynamicNabbitNode::release_blocking_lock() {
-  assert(this->blocking_lock > 0);
-  __sync_lock_release(&this->blocking_lock);
+int DynamicNabbitNode::join_counter() {
+  return state_join_counter(__atomic_load_n(&this->state, __ATOMIC_RELAXED));
 }
 
-bool DynamicNabbitNode::try_mark_as_visited() {
+// Changes the status from "from" to "to", leaving the join counter
+// alone.  Fails if the status is not "from".  The CAS only retries if
+// the join counter changed underneath us.
+bool DynamicNabbitNode::try_change_status(DAGNodeStatus from,
+					  DAGNodeStatus to) {
+  long long old_state = __atomic_load_n(&this->state, __ATOMIC_ACQUIRE);
+  while (state_status(old_state) == from) {
+    long long new_state = (old_state & ~DYNAMIC_NABBIT_STATUS_MASK) | (long long)to;
+    if (__atomic_compare_exchange_n(&this->state,
+				    &old_state,
+				    new_state,
+				    false,
+				    __ATOMIC_ACQ_REL,
+				    __ATOMIC_ACQUIRE)) {
+      return true;
+    }
+  }
+  return false;
+}
 
-  bool valid = __sync_bool_compare_and_swap(&this->status,
-					    NODE_UNVISITED,
-					    NODE_VISITED);
-  return valid;
+// Decrements the join counter, and returns the new count.  Also
+// stores the status the node had at the moment of the decrement.
+//
+// The release half of the fetch-and-add publishes the caller's
+// results to the successor; the acquire half lets whoever takes the
+// counter to 0 see the results of every other predecessor.
+int DynamicNabbitNode::decrement_join_counter(DAGNodeStatus* old_status) {
+  long long old_state = __atomic_fetch_sub(&this->state,
+					   DYNAMIC_NABBIT_JOIN_ONE,
+					   __ATOMIC_ACQ_REL);
+  assert(state_join_counter(old_state) > 0);
+  *old_status = state_status(old_state);
+  return state_join_counter(old_state) - 1;
+}
+
+// Records the arrival of the predecessor with index pred_idx, and
+// returns the new join counter, like decrement_join_counter.  If the
+// arrival stops at a leaf of the combining counter, returns 1 without
+// touching the state.  Predecessors only arrive once we have
+// registered with them, after we are EXPANDED, so that is the status
+// we report.
+int DynamicNabbitNode::arrive_from_predecessor(int pred_idx,
+					       DAGNodeStatus* old_status) {
+  if (this->combining &&
+      !this->combining->arrive(this->combining->leaf_for_index(pred_idx))) {
+    *old_status = NODE_EXPANDED;
+    return 1;
+  }
+  return this->decrement_join_counter(old_status);
+}
+
+// Called after Init(), before we register with any predecessor.  The
+// join counter counts 1 for each predecessor, plus 1 for ourselves;
+// replace the predecessors by the leaves they arrive at.
+void DynamicNabbitNode::use_combining_counter() {
+  int num_preds = this->predecessors->size_estimate();
+  NabbitCombiningCounter* c = new (H->get_slab()) NabbitCombiningCounter(NABBIT_COMBINING_LEAVES);
+  int num_leaves_used = 0;
+  for (int i = 0; i < num_preds; i++) {
+    if (c->add_arrival(c->leaf_for_index(i))) {
+      num_leaves_used++;
+    }
+  }
+  this->combining = c;
+  __atomic_fetch_sub(&this->state,
+		     (long long)(num_preds - num_leaves_used) * DYNAMIC_NABBIT_JOIN_ONE,
+		     __ATOMIC_RELAXED);
+}
+
+bool DynamicNabbitNode::try_mark_as_visited() {
+  return this->try_change_status(NODE_UNVISITED, NODE_VISITED);
 }
 
 
 void DynamicNabbitNode::mark_as_visited() {
-  bool valid = __sync_bool_compare_and_swap(&this->status,
-					    NODE_UNVISITED,
-					    NODE_VISITED);
+  bool valid = this->try_change_status(NODE_UNVISITED, NODE_VISITED);
   assert(valid);
   if (PRINT_STATE_CHANGES) {
     printf("--- Key %llu: marking as VISITED. join_counter = %d\n",
 	   this->key,
-	   this->join_counter);
+	   this->join_counter());
   }
 }
 
 void DynamicNabbitNode::mark_as_expanded() {
-  bool valid = __sync_bool_compare_and_swap(&this->status,
-					    NODE_VISITED,
-					    NODE_EXPANDED);
+  bool valid = this->try_change_status(NODE_VISITED, NODE_EXPANDED);
   if (!valid) {
     printf("Mark as expanded: Worker %d, key = %llu, status = %d\n",
 	   GET_WORKER_ID, // cilk::current_worker_id(),
 	   this->key,
-	   this->status);
+	   this->get_status());
   }
   assert(valid);
 
   if (PRINT_STATE_CHANGES) {
     printf("--- Key %llu: marking as EXPANDED. join_counter = %d\n",
 	   this->key,
-	   this->join_counter);
+	   this->join_counter());
   }
 }
 
 
 
 void DynamicNabbitNode::mark_as_computed() {
-  bool valid = __sync_bool_compare_and_swap(&this->status,
-					    NODE_EXPANDED,
-					    NODE_COMPUTED);
+  bool valid = this->try_change_status(NODE_EXPANDED, NODE_COMPUTED);
   assert(valid);
   if (PRINT_STATE_CHANGES) {
     printf("--- Key %llu: marking as COMPUTED. join_counter = %d\n",
 	   this->key,
-	   this->join_counter);
+	   this->join_counter());
   }
 }
 
-// To switch from computed to completed, we need to be holding the
-// lock on the blocking array.
-bool DynamicNabbitNode::try_mark_as_completed() {
-  bool val = false;
-  acquire_blocking_lock();
-  {
-    if (this->notify_counter == this->succ_to_notify->size_estimate()) {
-      bool valid = __sync_bool_compare_and_swap(&this->status,
-						NODE_COMPUTED,
-						NODE_COMPLETED);
-      assert(valid);
-      val = true;
+// We only switch from computed to completed after the successor
+// list has been sealed.
+void DynamicNabbitNode::mark_as_completed() {
+  assert(this->succ_head == DYNAMIC_NABBIT_SUCC_SEALED);
+  bool valid = this->try_change_status(NODE_COMPUTED, NODE_COMPLETED);
+  assert(valid);
+  if (PRINT_STATE_CHANGES) {
+    printf("--- Key %llu: marking as COMPLETED. join_counter = %d\n",
+	   this->key,
+	   this->join_counter());
+  }
+}
+
+// No successor can release its reference before this node is
+// COMPLETED, so it is safe to add the references here.
+void DynamicNabbitNode::set_successor_count(int num_succ) {
+  assert(num_succ >= 0);
+  if (H->reclaimer) {
+    this->counts_successors = true;
+    __sync_add_and_fetch(&this->ref_count, num_succ);
+  }
+}
+
+// Drops a reference.  The last reference marks the node as DEAD
+// and hands its memory to the reclaimer.  Marking the node DEAD
+// first means no reader which starts later will touch that memory.
+//
+// Nodes which did not call set_successor_count are never reclaimed.
+void DynamicNabbitNode::release_ref() {
+  if (!this->counts_successors) {
+    return;
+  }
+  int val = __sync_add_and_fetch(&this->ref_count, -1);
+  assert(val >= 0);
+  if (val == 0) {
+    bool valid = this->try_change_status(NODE_COMPLETED, NODE_DEAD);
+    assert(valid);
+    if (PRINT_STATE_CHANGES) {
+      printf("--- Key %llu: marking as DEAD.\n",
+	     this->key);
     }
+    H->reclaimer->retire((void*)this,
+			 &DynamicNabbitNode::reclaim_node);
   }
-  release_blocking_lock();
+}
 
-  if (PRINT_STATE_CHANGES) {
-    if (val) {
-      printf("--- Key %llu: marked as COMPLETED. join_counter = %d\n",
-	     this->key,
-	     this->join_counter);
+// The size of pred_nodes, which comes from H's slabs.
+size_t DynamicNabbitNode::pred_nodes_bytes() {
+  int num_preds = this->predecessors->size_estimate();
+  return (num_preds > 0 ? num_preds : 1) * sizeof(DynamicNabbitNode*);
+}
+
+// Called after Compute(), once we are done reading our
+// predecessors.
+void DynamicNabbitNode::release_predecessors() {
+  if (this->pred_nodes) {
+    for (int i = 0; i < this->predecessors->size_estimate(); i++) {
+      this->pred_nodes[i]->release_ref();
     }
+    nabbit_slab_free(this->pred_nodes, this->pred_nodes_bytes());
+    this->pred_nodes = NULL;
   }
-  return val;
+}
+
+// Run by the reclaimer, once no reader can still see the DEAD
+// node.  Deleting the node returns it to the slabs it came from.
+void DynamicNabbitNode::reclaim_node(void* node) {
+  DynamicNabbitNode* n = (DynamicNabbitNode*)node;
+  assert(n->get_status() == NODE_DEAD);
+  n->Reclaim();
+  n->H->remove_task(n->key);
+  delete n;
 }
 
 DAGNodeStatus DynamicNabbitNode::get_status() {
-  return this->status;
+  return state_status(__atomic_load_n(&this->state, __ATOMIC_ACQUIRE));
 }
 
+// Only the strand expanding this node adds dependencies, before it
+// registers with any predecessor, so nothing can race with this
+// increment.
 void DynamicNabbitNode::add_dep(long long key) {
   this->predecessors->add(key);
-  __sync_add_and_fetch(&this->join_counter,
-		       1);  
+  __atomic_fetch_add(&this->state,
+		     DYNAMIC_NABBIT_JOIN_ONE,
+		     __ATOMIC_RELAXED);
 }
 
 void DynamicNabbitNode::generate_task(long long key) {
@@ -268,7 +566,22 @@ void DynamicNabbitNode::generate_task(long long key) {
 /***************************************************************/
 // Methods for constructing the dag statically.
 
-void DynamicNabbitNode::try_init_pred_and_compute(long long pred_key) {
+// H->get_or_insert_task(), inside a reclaimer critical section if
+// nodes are being reclaimed, so that the table does not hand us a
+// node which is being freed.  The node we get back cannot be freed
+// until we drop our reference to it (see set_successor_count).
+void* DynamicNabbitNode::lookup_task(long long key, int* inserted) {
+  if (H->reclaimer == NULL) {
+    return H->get_or_insert_task(key, inserted);
+  }
+  int token = H->reclaimer->enter();
+  void* task = H->get_or_insert_task(key, inserted);
+  H->reclaimer->exit(token);
+  return task;
+}
+
+void DynamicNabbitNode::try_init_pred_and_compute(long long pred_key,
+						  int pred_idx) {
 
   bool inserted = false;
   DynamicNabbitNode* actualPredNode;
@@ -278,12 +591,15 @@ void DynamicNabbitNode::try_init_pred_and_compute(long long pred_key) {
 	 pred_key, this->key);
 #endif
   
-  actualPredNode = (DynamicNabbitNode*)H->get_task(pred_key);
-
-  // Keep trying to insert the node until we get something.
-  while (!actualPredNode) {
-    inserted = H->insert_task_if_absent(pred_key);
-    actualPredNode = (DynamicNabbitNode*)H->get_task(pred_key);
+  int inserted_flag = 0;
+  actualPredNode = (DynamicNabbitNode*)this->lookup_task(pred_key,
+							 &inserted_flag);
+  inserted = (inserted_flag != 0);
+
+  // Remember the predecessor, so we can drop our reference to it
+  // once our Compute() is done.
+  if (H->reclaimer) {
+    this->pred_nodes[pred_idx] = actualPredNode;
   }
 
   if (inserted) {
@@ -296,23 +612,31 @@ void DynamicNabbitNode::try_init_pred_and_compute(long long pred_key) {
   {
     bool pred_finished = true;
 
-    actualPredNode->acquire_blocking_lock();
-    DAGNodeStatus other_status = actualPredNode->status;
-
-    if (other_status < NODE_COMPUTED) {
-      actualPredNode->succ_to_notify->add(this);
+    // Register with the predecessor unless it has already sealed
+    // its successor list.
+    DynamicNabbitSuccCell* cell;
+    if (pred_idx < NABBIT_INLINE_DEGREE) {
+      cell = &this->succ_cells[pred_idx];
+      cell->succ = this;
+      cell->pred_idx = pred_idx;
+    }
+    else {
+      cell = new (H->get_slab()) DynamicNabbitSuccCell(this, pred_idx);
+    }
+    if (actualPredNode->try_register_successor(cell)) {
       pred_finished = false;
     }
+    else if (!cell->is_inline) {
+      delete cell;
+    }
 
 #if NABBIT_PRINT_DEBUG == 1
     printf("inserted = %d. finished? %d\n", inserted, pred_finished);
 #endif
-	   
-    actualPredNode->release_blocking_lock();
 
     if (pred_finished) {
-      int val = __sync_add_and_fetch(&this->join_counter,
-				     -1);
+      DAGNodeStatus old_status;
+      int val = this->arrive_from_predecessor(pred_idx, &old_status);
       if (val == 0) {
 #if NABBIT_PRINT_DEBUG == 1
 	printf("this node has key %llu. actualPred node has key %llu (should = %llu)\n",
@@ -333,22 +657,38 @@ void DynamicNabbitNode::try_init_pred_and_compute(long long pred_key) {
 
 void DynamicNabbitNode::init_node_and_compute() {
 
-  int default_children_count = 4;
   int i;
-  this->predecessors = new DTGSKeyArray(default_children_count);
+  this->predecessors = &this->pred_storage;
   Init();
 
+  if (this->predecessors->size_estimate() > NABBIT_COMBINING_THRESHOLD) {
+    this->use_combining_counter();
+  }
+
   this->mark_as_expanded();
 
-  // First try to init + compute predecessors.
-  for (i = 0; i < this->predecessors->size_estimate(); ++i) {
-    long long pred_key = this->predecessors->get(i);
-    cilk_spawn try_init_pred_and_compute(pred_key);
+  if (H->reclaimer) {
+    this->pred_nodes = (DynamicNabbitNode**)nabbit_slab_alloc(this->pred_nodes_bytes(),
+							      H->get_slab());
+  }
+
+  // First try to init + compute predecessors.  A large range is
+  // handed to init_pred_range() in a spawn, so we do not wait for
+  // the predecessors before dropping our own count below.
+  int num_preds = this->predecessors->size_estimate();
+  if (num_preds > NABBIT_SPAWN_GRAIN) {
+    cilk_spawn this->init_pred_range(0, num_preds);
+  }
+  else {
+    for (i = 0; i < num_preds; ++i) {
+      long long pred_key = this->predecessors->get(i);
+      cilk_spawn try_init_pred_and_compute(pred_key, i);
+    }
   }
 
   {
-    int val;
-    val = __sync_add_and_fetch(&this->join_counter, -1);
+    DAGNodeStatus old_status;
+    int val = this->decrement_join_counter(&old_status);
     if (val == 0) {
       compute_and_notify();
     }
@@ -357,6 +697,28 @@ void DynamicNabbitNode::init_node_and_compute() {
 
 
 
+// Spawns try_init_pred_and_compute() for predecessors [start, end),
+// splitting ranges larger than NABBIT_SPAWN_GRAIN in half, so a node
+// with d predecessors expands them all in O(log d) span.
+void DynamicNabbitNode::init_pred_range(int start, int end) {
+  while (end - start > NABBIT_SPAWN_GRAIN) {
+    int mid = start + (end - start) / 2;
+    cilk_spawn this->init_pred_range(start, mid);
+    start = mid;
+  }
+  for (int i = start; i < end; ++i) {
+    long long pred_key = this->predecessors->get(i);
+    cilk_spawn try_init_pred_and_compute(pred_key, i);
+  }
+}
+
+
+void* DynamicNabbitNode::scratch(size_t bytes) {
+  assert(this->scratch_arena != NULL);
+  return this->scratch_arena->alloc(bytes);
+}
+
+
 /***************************************************************/
 // Methods which call Compute() and do bookkeepping.
 
@@ -368,10 +730,16 @@ void DynamicNabbitNode::compute_and_notify() {
 	 GET_WORKER_ID); // cilk::current_worker_id());
          
 #endif
-  this->Compute();
+  {
+    NabbitScratchArena arena;
+    this->scratch_arena = &arena;
+    this->Compute();
+    this->scratch_arena = NULL;
+  }
+  this->release_predecessors();
   this->mark_as_computed();
 
-  this->generated_tasks = new DTGSKeyArray(4);
+  this->generated_tasks = &this->generated_storage;
   this->Generate();
 
   for (int i = 0; i < this->generated_tasks->size_estimate(); ++i) {
@@ -379,37 +747,73 @@ void DynamicNabbitNode::compute_and_notify() {
     cilk_spawn init_root_and_compute(gen_key);
   }
 
-  this->notify_counter = 0;
-  int end_to_notify = 0;
-
-
-  // Keep notifying the children in the blocking array until we
-  // have reached the end of the array.
+  // Keep detaching and notifying batches of successors until we
+  // find the list empty and manage to seal it.
+  //
+  // Note that successors may keep registering while we notify, as
+  // more nodes are being expanded.  Each one either lands in a
+  // later batch, or sees the sealed list and does not wait on us.
   //
-  // Note that the blocking array might grow, as more nodes are
-  // being expanded.  On the other hand, the size of the
-  // blocking array always monotonically increases.  
+#if NABBIT_PREFETCH_DISTANCE > 0
+  // As in StaticNabbitNode, a successor we enable is spawned right
+  // after the next notification (or at the end of its batch).
+  DynamicNabbitNode* enabled_succ = NULL;
+#endif
+  int num_enabled = 0;
   bool done = false;
   while (!done) {
 
-    end_to_notify = this->succ_to_notify->size_estimate();
-    
-    // Handle the current range of values in the blocking array.
-    //    cilk_for (int i = this->notify_counter; i < end_to_notify; i++) {
-    for (int i = this->notify_counter; i < end_to_notify; i++) {
-      
-      DynamicNabbitNode* current_succ = this->succ_to_notify->get(i);
-      
-      assert(current_succ->join_counter > 0);
+    DynamicNabbitSuccCell* batch = this->try_detach_successors();
+    if (batch == DYNAMIC_NABBIT_SUCC_SEALED) {
+      done = true;
+      batch = NULL;
+    }
+    else if (batch != NULL) {
+      NABBIT_PREFETCH_WRITE(&batch->succ->state);
+      NABBIT_PREFETCH_READ(batch->next);
+    }
 
-      assert((current_succ->status == NODE_VISITED) ||
-	     (current_succ->status == NODE_EXPANDED));
+    // Handle the current batch of successors.
+    while (batch) {
+      
+      DynamicNabbitNode* current_succ = batch->succ;
+      DynamicNabbitSuccCell* next_cell = batch->next;
+      int pred_idx = batch->pred_idx;
+
+      // We prefetched next_cell on the previous iteration, so look at
+      // its successor now, and fetch the cell after it.
+      if (next_cell != NULL) {
+	NABBIT_PREFETCH_WRITE(&next_cell->succ->state);
+	NABBIT_PREFETCH_READ(next_cell->next);
+      }
 
-      int updated_val = __sync_add_and_fetch(&current_succ->join_counter,
-					     -1);
+      // An inline cell lives in current_succ, so we must be done
+      // with it before the notification below.
+      if (!batch->is_inline) {
+	delete batch;
+      }
+      batch = next_cell;
+      
+      // One atomic operation decrements the counter and tells us
+      // the status of the successor at that moment.
+      DAGNodeStatus succ_status;
+      int updated_val = current_succ->arrive_from_predecessor(pred_idx,
+							       &succ_status);
+
+      assert((succ_status == NODE_VISITED) ||
+	     (succ_status == NODE_EXPANDED));
+
+#if NABBIT_PREFETCH_DISTANCE > 0
+      if (enabled_succ != NULL) {
+	cilk_spawn enabled_succ->compute_and_notify();
+	enabled_succ = NULL;
+      }
+#endif
 
       if (updated_val == 0) {
-	assert((current_succ->status == NODE_EXPANDED));
+	assert(succ_status == NODE_EXPANDED);
+	num_enabled++;
+	NABBIT_ELASTIC_NOTE_READY(num_enabled);
 
 	// The parent node has been EXPANDED.  Now we should
 	// push the parent node onto our deque.
@@ -418,34 +822,44 @@ void DynamicNabbitNode::compute_and_notify() {
 	printf("Worker %d enabling current_succ with key = %llu.  Node's status is %d\n",
 	       GET_WORKER_ID, // cilk::current_worker_id(),
 	       current_succ->key,
-	       current_succ->status);
+	       succ_status);
 #endif
+#if NABBIT_PREFETCH_DISTANCE > 0
+	current_succ->PrefetchInputs();
+	enabled_succ = current_succ;
+#else
 	cilk_spawn current_succ->compute_and_notify();
+#endif
       }
     }
 
-    this->notify_counter = end_to_notify;
-    
-    // Check to see if we have notified everyone in the
-    // blocking array.
-    done = this->try_mark_as_completed();
+#if NABBIT_PREFETCH_DISTANCE > 0
+    if (enabled_succ != NULL) {
+      cilk_spawn enabled_succ->compute_and_notify();
+      enabled_succ = NULL;
+    }
+#endif
   }
 
+  this->mark_as_completed();
+
   cilk_sync;
-  assert(this->status == NODE_COMPLETED);
+  assert(this->get_status() == NODE_COMPLETED);
+
+  // Drop the reference the node holds to itself.
+  if (H->reclaimer) {
+    this->release_ref();
+  }
 }
 
 
 bool DynamicNabbitNode::init_root_and_compute(long long root_key) {
 
   bool inserted = false;
-  DynamicNabbitNode* actualNode = (DynamicNabbitNode*)H->get_task(root_key);
-  
-  // Keep trying to insert the node until we get something.
-  while (!actualNode) {
-    inserted = H->insert_task_if_absent(root_key);
-    actualNode = (DynamicNabbitNode*)H->get_task(root_key);
-  }
+  int inserted_flag = 0;
+  DynamicNabbitNode* actualNode = (DynamicNabbitNode*)this->lookup_task(root_key,
+									&inserted_flag);
+  inserted = (inserted_flag != 0);
 
   if (inserted) {
     //    actualNode->mark_as_visited();
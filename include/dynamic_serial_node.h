@@ -30,6 +30,9 @@
 
 #include <dag_status.h>
 #include <dynamic_array.h>
+#include <nabbit_inline_array.h>
+#include <nabbit_node_layout.h>
+#include <nabbit_scratch_arena.h>
 #include <task_graph_hash_table.h>
 
 // Debugging flag.
@@ -40,20 +43,23 @@
 
 class DynamicSerialNode;
 
-typedef DynamicArray<long long> DTGSKeyArray;
-typedef DynamicArray<DynamicSerialNode*> DynamicSerialNodeArray;
+typedef NabbitInlineArray<long long, NABBIT_INLINE_DEGREE> DTGSKeyArray;
+typedef NabbitInlineArray<DynamicSerialNode*, NABBIT_INLINE_DEGREE> DynamicSerialNodeArray;
 
 class DynamicSerialNode {
 
  public:
   long long key; 
   TaskGraphHashTable* H;
+  // Points at pred_storage once the node is expanded.
   DTGSKeyArray* predecessors;
   
   // Constructors for a node.
   DynamicSerialNode(long long k, TaskGraphHashTable* H);
   DynamicSerialNode(long long k, TaskGraphHashTable* H, int num_succ);
-  ~DynamicSerialNode();
+  virtual ~DynamicSerialNode();
+
+  NABBIT_SLAB_ALLOCATED
 
   
   void add_dep(long long key);
@@ -68,8 +74,17 @@ class DynamicSerialNode {
     
   virtual void Init() = 0;
   virtual void Compute() = 0;
+
+  // Temporary memory for the current call to Compute().  It is freed
+  // automatically when Compute() returns.  Only call this from the
+  // Compute() strand itself (see nabbit_scratch_arena.h).
+  void* scratch(size_t bytes);
   virtual void Generate() = 0;
 
+  // Serial nodes are never reclaimed.  This method only exists so
+  // that the same Init() works for both kinds of dynamic nodes.
+  void set_successor_count(int num_succ) { }
+
 
 
  private:
@@ -79,9 +94,18 @@ class DynamicSerialNode {
   DynamicSerialNodeArray* succ_to_notify;
   DTGSKeyArray* generated_tasks;
 
+  // Storage for the arrays above, so low-degree nodes do not
+  // allocate them separately.
+  DTGSKeyArray pred_storage;
+  DynamicSerialNodeArray succ_storage;
+  DTGSKeyArray generated_storage;
+
   volatile int notify_counter; 
   volatile int blocking_lock;
 
+  // Only set while Compute() is running.
+  NabbitScratchArena* scratch_arena;
+
   inline void mark_as_visited();
 
   inline void mark_as_expanded();
@@ -114,9 +138,10 @@ DynamicSerialNode::DynamicSerialNode(long long k,
      predecessors(NULL),
      status(NODE_UNVISITED),
      join_counter(1),
-     succ_to_notify(new DynamicSerialNodeArray(4)),
+     succ_to_notify(&succ_storage),
      generated_tasks(NULL),     
-     blocking_lock(0) {
+     blocking_lock(0),
+     scratch_arena(NULL) {
 }
 
 // The same as the previous construct, except we pass in a default
@@ -130,22 +155,14 @@ DynamicSerialNode::DynamicSerialNode(long long k,
      predecessors(NULL),
      status(NODE_UNVISITED),
      join_counter(1),
-     succ_to_notify(new DynamicSerialNodeArray(num_succ)),
+     succ_to_notify(&succ_storage),
      generated_tasks(NULL),
-     blocking_lock(0) {
+     blocking_lock(0),
+     scratch_arena(NULL) {
 }
 
 
 DynamicSerialNode::~DynamicSerialNode() {
-  if (this->predecessors) {
-    delete this->predecessors;
-  }
-  if (this->succ_to_notify) {
-    delete this->succ_to_notify;
-  }
-  if (this->generated_tasks) {
-    delete this->generated_tasks;
-  }
 }
 
 
@@ -287,13 +304,10 @@ void DynamicSerialNode::try_init_pred_and_compute(long long pred_key) {
 	 pred_key, this->key);
 #endif
   
-  actualPredNode = (DynamicSerialNode*)H->get_task(pred_key);
-
-  // Keep trying to insert the node until we get something.
-  while (!actualPredNode) {
-    inserted = H->insert_task_if_absent(pred_key);
-    actualPredNode = (DynamicSerialNode*)H->get_task(pred_key);
-  }
+  int inserted_flag = 0;
+  actualPredNode = (DynamicSerialNode*)H->get_or_insert_task(pred_key,
+							     &inserted_flag);
+  inserted = (inserted_flag != 0);
 
   if (inserted) {
     //    actualPredNode->mark_as_visited();
@@ -335,9 +349,8 @@ void DynamicSerialNode::try_init_pred_and_compute(long long pred_key) {
 
 void DynamicSerialNode::init_node_and_compute() {
 
-  int default_children_count = 4;
   int i;
-  this->predecessors = new DTGSKeyArray(default_children_count);
+  this->predecessors = &this->pred_storage;
   Init();
 
   this->mark_as_expanded();
@@ -363,6 +376,12 @@ void DynamicSerialNode::init_node_and_compute() {
 
 
 
+void* DynamicSerialNode::scratch(size_t bytes) {
+  assert(this->scratch_arena != NULL);
+  return this->scratch_arena->alloc(bytes);
+}
+
+
 /***************************************************************/
 // Methods which call Compute() and do bookkeepping.
 
@@ -374,10 +393,15 @@ void DynamicSerialNode::compute_and_notify() {
 	 GET_WORKER_ID, //cilk::current_worker_id()
         );
 #endif
-  this->Compute();
+  {
+    NabbitScratchArena arena;
+    this->scratch_arena = &arena;
+    this->Compute();
+    this->scratch_arena = NULL;
+  }
   this->mark_as_computed();
 
-  this->generated_tasks = new DTGSKeyArray(4);
+  this->generated_tasks = &this->generated_storage;
   this->Generate();
 
   for (int i = 0; i < this->generated_tasks->size_estimate(); ++i) {
@@ -399,10 +423,24 @@ void DynamicSerialNode::compute_and_notify() {
   while (!done) {
 
     end_to_notify = this->succ_to_notify->size_estimate();
+
+#if NABBIT_PREFETCH_DISTANCE > 0
+    for (int i = this->notify_counter;
+	 (i < this->notify_counter + NABBIT_PREFETCH_DISTANCE) && (i < end_to_notify);
+	 i++) {
+      NABBIT_PREFETCH_WRITE(&this->succ_to_notify->get(i)->join_counter);
+    }
+#endif
     
     // Handle the current range of values in the blocking array.
     //    cilk_for (int i = this->notify_counter; i < end_to_notify; i++) {
     for (int i = this->notify_counter; i < end_to_notify; i++) {
+
+#if NABBIT_PREFETCH_DISTANCE > 0
+      if (i + NABBIT_PREFETCH_DISTANCE < end_to_notify) {
+	NABBIT_PREFETCH_WRITE(&this->succ_to_notify->get(i + NABBIT_PREFETCH_DISTANCE)->join_counter);
+      }
+#endif
       
       DynamicSerialNode* current_succ = this->succ_to_notify->get(i);
       
@@ -451,13 +489,10 @@ void DynamicSerialNode::compute_and_notify() {
 bool DynamicSerialNode::init_root_and_compute(long long root_key) {
 
   bool inserted = false;
-  DynamicSerialNode* actualNode = (DynamicSerialNode*)H->get_task(root_key);
-  
-  // Keep trying to insert the node until we get something.
-  while (!actualNode) {
-    inserted = H->insert_task_if_absent(root_key);
-    actualNode = (DynamicSerialNode*)H->get_task(root_key);
-  }
+  int inserted_flag = 0;
+  DynamicSerialNode* actualNode = (DynamicSerialNode*)H->get_or_insert_task(root_key,
+									    &inserted_flag);
+  inserted = (inserted_flag != 0);
 
   if (inserted) {
     //    actualNode->mark_as_visited();
@@ -0,0 +1,344 @@
+// Code for the Nabbit task graph library
+//
+// Copyright (c) 2010 Jim Sukha
+//
+//
+/*
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use, copy,
+ * modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+
+#ifndef _NABBIT_AFFINITY_H_
+#define _NABBIT_AFFINITY_H_
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sched.h>
+#include <algorithm>
+#include <vector>
+#include <dag_status.h>
+#include <nabbit_numa.h>
+
+
+/**********************************************
+ * Pinning Cilk workers to CPUs.
+ *
+ *  The Cilk runtime lets the OS move its worker threads between CPUs.
+ *  That makes timings hard to reproduce, and it breaks the cycle
+ *  counter logs in nabbit_logging.h, which assume that a worker stays
+ *  on one processor.
+ *
+ *  NabbitAffinity pins worker p to one CPU.  The policy is given as a
+ *  string, usually from the NABBIT_AFFINITY environment variable:
+ *
+ *    none       Do not pin (the default).
+ *    compact    Fill one socket before moving to the next, with the
+ *               hyperthreads of a core next to each other.
+ *    scatter    Spread consecutive workers over the sockets, using
+ *               one thread of every core before any second thread.
+ *    <cpulist>  Worker p gets the p-th CPU of the list, in the
+ *               kernel's format, e.g. "0,2,4-7".
+ *
+ *  Appending ":nosmt" (e.g., "compact:nosmt") uses only the first
+ *  thread of each core.  Only CPUs the process is allowed to run on
+ *  are used.  With more workers than CPUs, the mapping wraps around.
+ *
+ *  Sockets and cores come from /sys/devices/system/cpu.  apply(P)
+ *  must be called from a serial section of the program, with all P
+ *  workers stealing: it spawns P strands which wait at a barrier, so
+ *  that each worker runs exactly one of them and pins itself (the
+ *  same trick as NabbitTaskGraphStats::global_time_barrier()).
+ *  Afterwards, get_worker_cpu(p) gives the CPU of worker p, which the
+ *  program can record in its log (see
+ *  NabbitTaskGraphStats::set_worker_cpu()).
+ */
+
+#define NABBIT_AFFINITY_ENV "NABBIT_AFFINITY"
+#define NABBIT_CPU_SYSFS_DIR "/sys/devices/system/cpu"
+
+
+class NabbitAffinity {
+
+ public:
+  enum Policy {
+    NABBIT_AFFINITY_NONE = 0,
+    NABBIT_AFFINITY_COMPACT = 1,
+    NABBIT_AFFINITY_SCATTER = 2,
+    NABBIT_AFFINITY_LIST = 3
+  };
+
+ private:
+
+  // Where a CPU sits in the machine.
+  struct CpuPlace {
+    int cpu;
+    int package;
+    int core;
+    // Which thread of its core this CPU is (0 for the first).
+    int thread;
+    // Which core of its package this is (0 for the first).
+    int core_rank;
+  };
+
+  static bool compact_order(const CpuPlace& a, const CpuPlace& b) {
+    if (a.package != b.package) return a.package < b.package;
+    if (a.core_rank != b.core_rank) return a.core_rank < b.core_rank;
+    return a.thread < b.thread;
+  }
+
+  static bool scatter_order(const CpuPlace& a, const CpuPlace& b) {
+    if (a.thread != b.thread) return a.thread < b.thread;
+    if (a.core_rank != b.core_rank) return a.core_rank < b.core_rank;
+    return a.package < b.package;
+  }
+
+  Policy policy;
+  bool avoid_smt;
+  // Workers are assigned CPUs from this list, in order.
+  std::vector<int> order;
+  std::vector<int> worker_cpu;
+  volatile int barrier_counter;
+
+  static int read_sysfs_int(const char* sysfs_dir, int cpu,
+			    const char* file, int default_val) {
+    char path[1024];
+    snprintf(path, sizeof(path), "%s/cpu%d/topology/%s", sysfs_dir, cpu, file);
+    FILE* f = fopen(path, "r");
+    if (f == NULL) {
+      return default_val;
+    }
+    int val = default_val;
+    if (fscanf(f, "%d", &val) != 1) {
+      val = default_val;
+    }
+    fclose(f);
+    return val;
+  }
+
+  // The CPUs the process may run on, in increasing order.
+  static std::vector<int> allowed_cpus() {
+    std::vector<int> cpus;
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    if (sched_getaffinity(0, sizeof(set), &set) == 0) {
+      for (int c = 0; c < CPU_SETSIZE; c++) {
+	if (CPU_ISSET(c, &set)) {
+	  cpus.push_back(c);
+	}
+      }
+    }
+    return cpus;
+  }
+
+  // Orders the allowed CPUs for the compact and scatter policies.
+  void build_order(const std::vector<int>& allowed, const char* sysfs_dir) {
+    std::vector<CpuPlace> places;
+    for (size_t i = 0; i < allowed.size(); i++) {
+      CpuPlace c;
+      c.cpu = allowed[i];
+      c.package = read_sysfs_int(sysfs_dir, c.cpu, "physical_package_id", 0);
+      c.core = read_sysfs_int(sysfs_dir, c.cpu, "core_id", c.cpu);
+      c.thread = 0;
+      c.core_rank = 0;
+      // Count the threads of the same core which come before this
+      // CPU.
+      for (size_t j = 0; j < places.size(); j++) {
+	if (places[j].package == c.package) {
+	  if (places[j].core == c.core) {
+	    c.thread++;
+	  }
+	}
+      }
+      places.push_back(c);
+    }
+    // Number the cores of each package in order of their core ids.
+    for (size_t i = 0; i < places.size(); i++) {
+      std::vector<int> smaller_cores;
+      for (size_t j = 0; j < places.size(); j++) {
+	if ((places[j].package == places[i].package) &&
+	    (places[j].core < places[i].core) &&
+	    (std::find(smaller_cores.begin(), smaller_cores.end(),
+		       places[j].core) == smaller_cores.end())) {
+	  smaller_cores.push_back(places[j].core);
+	}
+      }
+      places[i].core_rank = (int)smaller_cores.size();
+    }
+
+    std::sort(places.begin(), places.end(),
+	      (policy == NABBIT_AFFINITY_SCATTER) ? scatter_order : compact_order);
+    for (size_t i = 0; i < places.size(); i++) {
+      if (avoid_smt && (places[i].thread > 0)) {
+	continue;
+      }
+      order.push_back(places[i].cpu);
+    }
+  }
+
+  // Pins the calling worker, once all P workers have arrived.
+  void pin_local(int P) {
+    __sync_add_and_fetch(&this->barrier_counter, 1);
+    while (this->barrier_counter != P) {
+      __sync_synchronize();
+    }
+
+    int p = GET_WORKER_ID;
+    if ((p < 0) || (p >= P)) {
+      return;
+    }
+    int cpu = this->order[p % this->order.size()];
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    if (sched_setaffinity(0, sizeof(set), &set) == 0) {
+      this->worker_cpu[p] = cpu;
+    }
+    else {
+      printf("WARNING: could not pin worker %d to CPU %d\n", p, cpu);
+    }
+  }
+
+ public:
+
+  // spec is a policy string as described above (NULL means "none").
+  // allowed_cpus is a CPU list to use instead of the CPUs the process
+  // may run on, and sysfs_dir replaces /sys/devices/system/cpu.
+  NabbitAffinity(const char* spec,
+		 const char* allowed_cpulist = NULL,
+		 const char* sysfs_dir = NABBIT_CPU_SYSFS_DIR)
+    : policy(NABBIT_AFFINITY_NONE),
+      avoid_smt(false),
+      barrier_counter(0) {
+    if ((spec == NULL) || (spec[0] == '\0')) {
+      return;
+    }
+
+    char name[1024];
+    snprintf(name, sizeof(name), "%s", spec);
+    char* suffix = strchr(name, ':');
+    if (suffix != NULL) {
+      *suffix = '\0';
+      suffix++;
+      if (strcmp(suffix, "nosmt") == 0) {
+	avoid_smt = true;
+      }
+      else {
+	printf("WARNING: ignoring unknown affinity option \"%s\"\n", suffix);
+      }
+    }
+
+    std::vector<int> allowed;
+    int* cpus = new int[NABBIT_NUMA_MAX_CPUS];
+    if (allowed_cpulist != NULL) {
+      int n = nabbit_parse_cpulist(allowed_cpulist, cpus, NABBIT_NUMA_MAX_CPUS);
+      assert(n >= 0);
+      allowed.assign(cpus, cpus + n);
+      std::sort(allowed.begin(), allowed.end());
+    }
+    else {
+      allowed = allowed_cpus();
+    }
+
+    if (strcmp(name, "none") == 0) {
+      policy = NABBIT_AFFINITY_NONE;
+    }
+    else if (strcmp(name, "compact") == 0) {
+      policy = NABBIT_AFFINITY_COMPACT;
+      build_order(allowed, sysfs_dir);
+    }
+    else if (strcmp(name, "scatter") == 0) {
+      policy = NABBIT_AFFINITY_SCATTER;
+      build_order(allowed, sysfs_dir);
+    }
+    else {
+      int n = nabbit_parse_cpulist(name, cpus, NABBIT_NUMA_MAX_CPUS);
+      if (n <= 0) {
+	printf("WARNING: unknown affinity policy \"%s\", not pinning workers\n",
+	       name);
+      }
+      else {
+	policy = NABBIT_AFFINITY_LIST;
+	for (int i = 0; i < n; i++) {
+	  if (std::find(allowed.begin(), allowed.end(), cpus[i]) != allowed.end()) {
+	    order.push_back(cpus[i]);
+	  }
+	  else {
+	    printf("WARNING: skipping CPU %d, which the process may not use\n",
+		   cpus[i]);
+	  }
+	}
+      }
+    }
+    delete[] cpus;
+
+    if ((policy != NABBIT_AFFINITY_NONE) && order.empty()) {
+      printf("WARNING: no CPUs for affinity policy \"%s\", not pinning workers\n",
+	     spec);
+      policy = NABBIT_AFFINITY_NONE;
+    }
+  }
+
+  // The policy named by the NABBIT_AFFINITY environment variable.
+  static NabbitAffinity* from_env() {
+    return new NabbitAffinity(getenv(NABBIT_AFFINITY_ENV));
+  }
+
+  Policy get_policy() const {
+    return policy;
+  }
+
+  // The CPUs workers are assigned, in order.
+  const std::vector<int>& get_order() const {
+    return order;
+  }
+
+  // Pins each of the P workers to its CPU.
+  void apply(int P) {
+    assert(P > 0);
+    this->worker_cpu.assign(P, -1);
+    if (this->policy == NABBIT_AFFINITY_NONE) {
+      return;
+    }
+    this->barrier_counter = 0;
+    for (int p = 0; p < P; p++) {
+      cilk_spawn this->pin_local(P);
+    }
+    cilk_sync;
+  }
+
+  // The CPU worker p was pinned to by apply(), or -1.
+  int get_worker_cpu(int p) const {
+    if ((p < 0) || (p >= (int)this->worker_cpu.size())) {
+      return -1;
+    }
+    return this->worker_cpu[p];
+  }
+
+  void print_mapping() const {
+    for (size_t p = 0; p < this->worker_cpu.size(); p++) {
+      printf("Worker %zd -> CPU %d\n", p, this->worker_cpu[p]);
+    }
+  }
+};
+
+#endif
@@ -0,0 +1,151 @@
+// Code for the Nabbit task graph library
+//
+// Copyright (c) 2010 Jim Sukha
+//
+//
+/*
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use, copy,
+ * modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef _NABBIT_COMBINING_COUNTER_H_
+#define _NABBIT_COMBINING_COUNTER_H_
+
+#include <assert.h>
+#include <stdlib.h>
+#include <dag_status.h>
+#include <nabbit_slab_allocator.h>
+
+
+/**********************************************
+ * Combining join counters for nodes with a very high in-degree.
+ *
+ *  Every predecessor of a node decrements the node's join counter
+ *  when it finishes.  For a sink with thousands of predecessors, all
+ *  of those atomic operations go to one cache line, and each one
+ *  waits for the line to move between workers.
+ *
+ *  Once a node has more than NABBIT_COMBINING_THRESHOLD predecessors,
+ *  the node types spread its arrivals over a NabbitCombiningCounter:
+ *  a row of NABBIT_COMBINING_LEAVES leaf counters, each on its own
+ *  cache line.  Each predecessor always arrives at the same leaf.
+ *  The node's own join counter then only counts the leaves which
+ *  expect at least one arrival, and the arrival which takes a leaf
+ *  to 0 passes on to the join counter.  An arrival therefore touches
+ *  one lightly shared leaf, and only 1 in (degree / leaves) arrivals
+ *  touches the join counter.  Exactly one arrival takes the join
+ *  counter to 0, just as before.
+ *
+ *  Leaves are counted down with acquire-release atomics, so the
+ *  arrival which enables the node sees the results of every
+ *  predecessor, through whichever leaves they arrived at.
+ *
+ *  All arrivals at a leaf must be registered (add_arrival) before
+ *  the first one happens.
+ */
+
+#ifndef NABBIT_COMBINING_THRESHOLD
+#define NABBIT_COMBINING_THRESHOLD 1024
+#endif
+
+#ifndef NABBIT_COMBINING_LEAVES
+#define NABBIT_COMBINING_LEAVES 64
+#endif
+
+#if NABBIT_COMBINING_LEAVES < 1
+#error "NABBIT_COMBINING_LEAVES must be at least 1"
+#endif
+
+
+struct NabbitCombiningLeaf {
+  int count;
+  char padding[NABBIT_CACHE_LINE_SIZE - sizeof(int)];
+};
+
+
+class NabbitCombiningCounter {
+
+ private:
+  int num_leaves;
+  NabbitCombiningLeaf* leaves;
+
+ public:
+  NabbitCombiningCounter(int num_leaves_)
+    : num_leaves(num_leaves_), leaves(NULL) {
+    assert(num_leaves > 0);
+    void* mem = NULL;
+    int err = posix_memalign(&mem,
+			     NABBIT_CACHE_LINE_SIZE,
+			     num_leaves * sizeof(NabbitCombiningLeaf));
+    assert((err == 0) && (mem != NULL));
+    leaves = (NabbitCombiningLeaf*)mem;
+    for (int i = 0; i < num_leaves; i++) {
+      leaves[i].count = 0;
+    }
+  }
+
+  ~NabbitCombiningCounter() {
+    free(leaves);
+  }
+
+  int get_num_leaves() {
+    return num_leaves;
+  }
+
+  // The leaf for the arrival with the given index.  Consecutive
+  // indices go to different leaves, since they tend to arrive at the
+  // same time.
+  inline int leaf_for_index(long long idx) {
+    return (int)(idx % num_leaves);
+  }
+
+  // The leaf for an arrival named by a pointer, e.g., the
+  // predecessor itself.
+  inline int leaf_for_pointer(void* p) {
+    unsigned long long h = (unsigned long long)(size_t)p;
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+    return (int)(h % (unsigned long long)num_leaves);
+  }
+
+  // Expects one more arrival at leaf.  Returns true if this is the
+  // first arrival at the leaf, i.e., the join counter should expect
+  // one more arrival from this leaf.
+  inline bool add_arrival(int leaf) {
+    assert((leaf >= 0) && (leaf < num_leaves));
+    return (__atomic_fetch_add(&leaves[leaf].count, 1, __ATOMIC_RELAXED) == 0);
+  }
+
+  // Records one arrival at leaf.  Returns true if it was the last
+  // arrival the leaf expects, in which case the caller must pass the
+  // arrival on to the join counter.
+  inline bool arrive(int leaf) {
+    assert((leaf >= 0) && (leaf < num_leaves));
+    int val = __atomic_sub_fetch(&leaves[leaf].count, 1, __ATOMIC_ACQ_REL);
+    assert(val >= 0);
+    return (val == 0);
+  }
+
+  NABBIT_SLAB_ALLOCATED
+};
+
+
+#endif
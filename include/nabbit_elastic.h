@@ -0,0 +1,227 @@
+// Code for the Nabbit task graph library
+//
+// Copyright (c) 2010 Jim Sukha
+//
+//
+/*
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use, copy,
+ * modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+
+#ifndef _NABBIT_ELASTIC_H_
+#define _NABBIT_ELASTIC_H_
+
+#include <assert.h>
+#include <limits.h>
+#include <unistd.h>
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <dag_status.h>
+
+
+/**********************************************
+ * Parking idle workers.
+ *
+ *  An idle Cilk worker keeps trying to steal, at 100% CPU, even
+ *  during the long ramp-up of a wavefront DAG, where only a few nodes
+ *  are ready at a time.  The Cilk runtime does not let us change how
+ *  its workers look for work, or how many of them there are while it
+ *  runs.  Instead, NabbitElasticWorkers keeps workers busy doing
+ *  nothing: it spawns "park" strands, and a worker which picks one up
+ *  sleeps on a futex instead of stealing.
+ *
+ *  E->source_compute(source) runs a DAG with E->get_target() active
+ *  workers: it spawns P - target park strands, runs the DAG, and
+ *  then wakes every parked worker.  A parked worker spins for
+ *  NABBIT_ELASTIC_SPIN iterations before it goes to sleep, so a
+ *  short park costs no system calls.
+ *
+ *  The number of active workers can grow while the DAG runs:
+ *
+ *   1. set_target(k) from any thread (e.g., from Compute(), once the
+ *      program knows the DAG is getting wider) wakes parked workers
+ *      until k are active.
+ *   2. When compiled with -DNABBIT_ELASTIC_WORKERS, the node types
+ *      report ready work: each successor a node enables after its
+ *      first one (which the node's own worker runs next) is a ready
+ *      node nobody is working on, and wakes one parked worker.
+ *
+ *  A woken worker goes back to stealing, and cannot be parked again
+ *  until the next call to source_compute(): a park strand belongs to
+ *  the frame which spawned it, so a strand spawned by a node while
+ *  the DAG runs would hold up that node's cilk_sync.  Lowering the
+ *  target therefore takes effect from the next DAG.
+ *
+ *  Only one NabbitElasticWorkers can run a DAG at a time.
+ */
+
+#ifndef NABBIT_ELASTIC_SPIN
+#define NABBIT_ELASTIC_SPIN 10000
+#endif
+
+
+class NabbitElasticWorkers {
+
+ private:
+  int P;
+  // The number of workers which should be stealing.
+  volatile int target;
+  // Futex word.  Incremented every time parked workers should look
+  // at target (or done) again.
+  volatile int generation;
+  volatile int num_parked;
+  volatile int done;
+
+  static long futex(volatile int* addr, int op, int val) {
+    return syscall(SYS_futex, (int*)addr, op, val, NULL, NULL, 0);
+  }
+
+  void wake_parked() {
+    __sync_add_and_fetch(&this->generation, 1);
+    if (this->num_parked > 0) {
+      futex(&this->generation, FUTEX_WAKE_PRIVATE, INT_MAX);
+    }
+  }
+
+  // Park strand i stays parked while fewer than P - i workers should
+  // be active.
+  inline bool should_park(int i) {
+    return (!this->done) && (i < this->P - this->target);
+  }
+
+  static NabbitElasticWorkers* volatile* running_slot() {
+    static NabbitElasticWorkers* volatile running = NULL;
+    return &running;
+  }
+
+ public:
+  NabbitElasticWorkers(int P_, int initial_target)
+    : P(P_), target(P_), generation(0), num_parked(0), done(0) {
+    assert(P > 0);
+    this->set_target(initial_target);
+  }
+
+  int get_num_workers() const {
+    return this->P;
+  }
+
+  int get_target() const {
+    return this->target;
+  }
+
+  int get_num_parked() const {
+    return this->num_parked;
+  }
+
+  // Asks for k active workers, between 1 and P.  Wakes parked workers
+  // if k is larger than before.
+  void set_target(int k) {
+    if (k < 1) {
+      k = 1;
+    }
+    if (k > this->P) {
+      k = this->P;
+    }
+    int old_target = __sync_lock_test_and_set(&this->target, k);
+    if (k > old_target) {
+      this->wake_parked();
+    }
+  }
+
+  // Called when a node enables its num_enabled-th successor.  Every
+  // one after the first is work for another worker, so wake one.
+  void note_ready(int num_enabled) {
+    if ((num_enabled <= 1) || (this->num_parked == 0)) {
+      return;
+    }
+    int t = this->target;
+    while ((t < this->P) &&
+	   !__sync_bool_compare_and_swap(&this->target, t, t + 1)) {
+      t = this->target;
+    }
+    if (t < this->P) {
+      this->wake_parked();
+    }
+  }
+
+  // The body of park strand i, which source_compute() spawns.
+  // Returns once the worker running it should steal again.
+  void park(int i) {
+    __sync_add_and_fetch(&this->num_parked, 1);
+    for (int spin = 0; (spin < NABBIT_ELASTIC_SPIN) && this->should_park(i); spin++) {
+      __sync_synchronize();
+    }
+    while (true) {
+      int gen = this->generation;
+      if (!this->should_park(i)) {
+	break;
+      }
+      futex(&this->generation, FUTEX_WAIT_PRIVATE, gen);
+    }
+    __sync_add_and_fetch(&this->num_parked, -1);
+  }
+
+  // Runs the DAG starting at source (any node type with a
+  // source_compute() method), with the target number of workers.
+  template <class NodeType>
+  void source_compute(NodeType* source) {
+    NabbitElasticWorkers* volatile* running = running_slot();
+    bool installed = __sync_bool_compare_and_swap(running,
+						  (NabbitElasticWorkers*)NULL,
+						  this);
+    assert(installed);
+
+    this->done = 0;
+    int initial_target = this->target;
+    for (int i = 0; i < this->P - initial_target; i++) {
+      cilk_spawn this->park(i);
+    }
+    source->source_compute();
+
+    this->done = 1;
+    *running = NULL;
+    this->wake_parked();
+    cilk_sync;
+    assert(this->num_parked == 0);
+    (void)installed;
+  }
+
+  // The NabbitElasticWorkers running a DAG right now, if any.
+  static NabbitElasticWorkers* running() {
+    return *running_slot();
+  }
+};
+
+
+inline void nabbit_elastic_note_ready(int num_enabled) {
+  NabbitElasticWorkers* E = NabbitElasticWorkers::running();
+  if (E != NULL) {
+    E->note_ready(num_enabled);
+  }
+}
+
+#ifdef NABBIT_ELASTIC_WORKERS
+#define NABBIT_ELASTIC_NOTE_READY(num_enabled) nabbit_elastic_note_ready(num_enabled)
+#else
+#define NABBIT_ELASTIC_NOTE_READY(num_enabled) ((void)(num_enabled))
+#endif
+
+#endif
@@ -0,0 +1,254 @@
+// Code for the Nabbit task graph library
+//
+// Copyright (c) 2010 Jim Sukha
+//
+//
+/*
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use, copy,
+ * modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+
+
+#ifndef _NABBIT_EPOCH_RECLAIMER_H_
+#define _NABBIT_EPOCH_RECLAIMER_H_
+
+#include <assert.h>
+#include <stdio.h>
+#include <dag_status.h>
+#include <nabbit_slab_allocator.h>
+
+
+/**********************************************
+ * Epoch-based reclamation for Nabbit.
+ *
+ *  A NabbitEpochReclaimer defers freeing memory which other workers
+ *  might still be reading.  Instead of freeing an object directly, a
+ *  worker "retires" it, along with a function which frees it.  The
+ *  object is freed once every worker which could have seen it has
+ *  left its critical section.
+ *
+ *  Readers which look at shared objects without holding a reference
+ *  to them should do so inside a critical section:
+ *
+ *     int token = reclaimer->enter();
+ *     ... read shared objects ...
+ *     reclaimer->exit(token);
+ *
+ *  We keep a global epoch counter.  A worker entering a critical
+ *  section announces the current epoch.  The epoch can only advance
+ *  once every active worker has announced it, so an object retired in
+ *  epoch e is safe to free once the global epoch reaches e+2.  Each
+ *  worker keeps 3 limbo lists of retired objects, one for each epoch
+ *  which might still be in use.
+ *
+ *  In Cilk, a strand can finish on a different worker than it
+ *  started on (e.g., after a cilk_sync).  enter() therefore returns a
+ *  token naming the slot it used, and exit() releases that slot,
+ *  whichever worker is running.  Several strands can have entered
+ *  through the same slot, so each slot counts its active strands.
+ */
+
+#define NABBIT_EPOCH_NUM_LISTS 3
+
+// Try to advance the global epoch after this many retires on a
+// worker.
+#define NABBIT_EPOCH_ADVANCE_INTERVAL 64
+
+
+typedef void (*NabbitRetireFn)(void* ptr);
+
+struct NabbitRetiredItem {
+  void* ptr;
+  NabbitRetireFn free_fn;
+  NabbitRetiredItem* next;
+
+  NABBIT_SLAB_ALLOCATED
+};
+
+
+class NabbitEpochReclaimer {
+
+  // Each worker's state is padded out to its own cache line.
+  struct EpochWorkerState {
+    // Number of strands in a critical section using this slot, and
+    // the epoch they announced.
+    volatile int active;
+    volatile long long epoch;
+
+    // Limbo lists, and the epoch each list was filled in.  Only
+    // the worker which owns the slot touches these.
+    NabbitRetiredItem* limbo[NABBIT_EPOCH_NUM_LISTS];
+    long long limbo_epoch[NABBIT_EPOCH_NUM_LISTS];
+    int retire_count;
+
+    char padding[128
+		 - 2*sizeof(long long)
+		 - NABBIT_EPOCH_NUM_LISTS*(sizeof(NabbitRetiredItem*) + sizeof(long long))
+		 - sizeof(int)];
+  };
+
+ private:
+  int P;
+  EpochWorkerState* workers;
+  volatile long long global_epoch;
+
+
+  static void free_list(NabbitRetiredItem* item) {
+    while (item != NULL) {
+      NabbitRetiredItem* next = item->next;
+      item->free_fn(item->ptr);
+      delete item;
+      item = next;
+    }
+  }
+
+  // Frees the limbo lists of worker p that are at least 2 epochs old.
+  void collect(int p, long long current_epoch) {
+    EpochWorkerState* w = &workers[p];
+    for (int i = 0; i < NABBIT_EPOCH_NUM_LISTS; i++) {
+      if ((w->limbo[i] != NULL) &&
+	  (w->limbo_epoch[i] + 2 <= current_epoch)) {
+	free_list(w->limbo[i]);
+	w->limbo[i] = NULL;
+      }
+    }
+  }
+
+  // Advances the global epoch if every worker in a critical section
+  // has seen the current one.
+  bool try_advance() {
+    long long e = global_epoch;
+    __sync_synchronize();
+    for (int p = 0; p < P; p++) {
+      if ((workers[p].active > 0) && (workers[p].epoch != e)) {
+	return false;
+      }
+    }
+    return __sync_bool_compare_and_swap(&global_epoch, e, e+1);
+  }
+
+  inline int current_slot() {
+    int p = GET_WORKER_ID;
+    if ((p < 0) || (p >= P)) {
+      p = 0;
+    }
+    return p;
+  }
+
+
+ public:
+
+  // P is the number of worker threads we are running with.
+  NabbitEpochReclaimer(int P_) : P(P_), workers(NULL), global_epoch(0) {
+    assert(P > 0);
+    assert(sizeof(EpochWorkerState) == 128);
+    workers = new EpochWorkerState[P];
+    assert(workers);
+    for (int p = 0; p < P; p++) {
+      workers[p].active = 0;
+      workers[p].epoch = 0;
+      workers[p].retire_count = 0;
+      for (int i = 0; i < NABBIT_EPOCH_NUM_LISTS; i++) {
+	workers[p].limbo[i] = NULL;
+	workers[p].limbo_epoch[i] = 0;
+      }
+    }
+  }
+
+  // Frees everything that is still retired.  No worker should be
+  // inside a critical section.
+  ~NabbitEpochReclaimer() {
+    drain();
+    delete[] workers;
+  }
+
+
+  // Enters a critical section.  Returns the token to pass to exit().
+  int enter() {
+    int p = current_slot();
+    EpochWorkerState* w = &workers[p];
+    int old_active = __sync_fetch_and_add(&w->active, 1);
+    if (old_active == 0) {
+      w->epoch = global_epoch;
+    }
+    __sync_synchronize();
+    return p;
+  }
+
+  void exit(int token) {
+    assert((token >= 0) && (token < P));
+    assert(workers[token].active > 0);
+    __sync_synchronize();
+    __sync_add_and_fetch(&workers[token].active, -1);
+  }
+
+
+  // Schedules free_fn(ptr) to run once no critical section which
+  // might have seen ptr is still active.  The caller must already
+  // have made ptr unreachable for new readers.
+  void retire(void* ptr, NabbitRetireFn free_fn) {
+    int p = current_slot();
+    EpochWorkerState* w = &workers[p];
+    long long e = global_epoch;
+    int idx = (int)(e % NABBIT_EPOCH_NUM_LISTS);
+
+    // Anything left in this list is from epoch e-3 or earlier.
+    collect(p, e);
+    if (w->limbo[idx] == NULL) {
+      w->limbo_epoch[idx] = e;
+    }
+    assert(w->limbo_epoch[idx] == e);
+
+    NabbitRetiredItem* item = new NabbitRetiredItem;
+    item->ptr = ptr;
+    item->free_fn = free_fn;
+    item->next = w->limbo[idx];
+    w->limbo[idx] = item;
+
+    w->retire_count++;
+    if (w->retire_count >= NABBIT_EPOCH_ADVANCE_INTERVAL) {
+      w->retire_count = 0;
+      if (try_advance()) {
+	collect(p, global_epoch);
+      }
+    }
+  }
+
+  long long get_epoch() {
+    return global_epoch;
+  }
+
+  // Frees all retired objects, on all workers.  Should only be
+  // called when no worker is inside a critical section, e.g., after
+  // the computation is finished.
+  void drain() {
+    for (int p = 0; p < P; p++) {
+      assert(workers[p].active == 0);
+      for (int i = 0; i < NABBIT_EPOCH_NUM_LISTS; i++) {
+	free_list(workers[p].limbo[i]);
+	workers[p].limbo[i] = NULL;
+      }
+    }
+  }
+};
+
+
+#endif
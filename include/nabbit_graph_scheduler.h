@@ -0,0 +1,346 @@
+// Code for the Nabbit task graph library
+//
+// Copyright (c) 2010 Jim Sukha
+//
+//
+/*
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use, copy,
+ * modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+
+#ifndef _NABBIT_GRAPH_SCHEDULER_H_
+#define _NABBIT_GRAPH_SCHEDULER_H_
+
+#include <assert.h>
+#include <limits.h>
+#include <unistd.h>
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <sys/time.h>
+#include <vector>
+#include <dag_status.h>
+#include <nabbit_timers.h>
+
+
+/**********************************************
+ * Running many independent DAGs on one pool of workers.
+ *
+ *  Running each DAG in its own process oversubscribes the machine:
+ *  every process starts a worker per core.  NabbitGraphScheduler
+ *  instead runs DAGs (jobs) from many tenants inside one Cilk
+ *  computation, so they share one set of workers, which steal work
+ *  from every running DAG.
+ *
+ *  A job is any NabbitGraphJob, whose Run() evaluates the DAG, e.g.,
+ *  NabbitSourceJob, which calls source_compute() on a static source
+ *  node.  submit() returns a NabbitGraphFuture, which says when the
+ *  job is done.  Jobs can be submitted from any thread, including
+ *  from inside a running job.
+ *
+ *  run() spawns max_running strands, each of which takes jobs off the
+ *  queue and runs them until the queue is empty.  The next job is
+ *  chosen by:
+ *
+ *   1. Priority: a job with a higher priority always goes first.
+ *   2. Fair share: among tenants with a job of that priority, the
+ *      one with the least virtual time.  A tenant's virtual time
+ *      advances by the wall-clock time of each of its jobs, divided
+ *      by the tenant's weight, so a tenant with twice the weight
+ *      gets about twice the running time when both are busy.  A
+ *      tenant which was idle starts again at the smallest virtual
+ *      time of the busy tenants, so it cannot save up credit.
+ *   3. Jobs of one tenant and priority run in the order submitted.
+ *
+ *  All running DAGs share the workers through work stealing, which we
+ *  cannot weight, so fair share decides when a job starts, not how
+ *  many workers it gets.  A smaller max_running (e.g., 1) makes the
+ *  shares more exact, at the cost of less parallel slack.
+ *
+ *  Jobs run concurrently, so they must not use features which assume
+ *  one DAG at a time (NABBIT_LOCALITY_PLACEMENT,
+ *  NabbitElasticWorkers).
+ */
+
+
+class NabbitGraphJob {
+ public:
+  virtual ~NabbitGraphJob() { }
+  // Evaluates the DAG.  Called once, from a Cilk strand.
+  virtual void Run() = 0;
+};
+
+
+// Runs a static DAG from its source node.
+template <class NodeType>
+class NabbitSourceJob: public NabbitGraphJob {
+ private:
+  NodeType* source;
+ public:
+  NabbitSourceJob(NodeType* source_) : source(source_) { }
+  void Run() {
+    this->source->source_compute();
+  }
+};
+
+
+class NabbitGraphScheduler;
+
+class NabbitGraphFuture {
+  friend class NabbitGraphScheduler;
+
+ private:
+  NabbitGraphJob* job;
+  int tenant;
+  int priority;
+  // Next job of the same tenant and priority.
+  NabbitGraphFuture* next;
+  // Futex word: 0 until the job finishes.
+  volatile int done;
+  double submit_time;
+  double start_time;
+  double end_time;
+
+  NabbitGraphFuture(NabbitGraphJob* job_, int tenant_, int priority_)
+    : job(job_), tenant(tenant_), priority(priority_), next(NULL), done(0),
+      submit_time(0), start_time(0), end_time(0) { }
+
+ public:
+  NabbitGraphJob* get_job() const {
+    return this->job;
+  }
+
+  bool is_done() const {
+    return this->done != 0;
+  }
+
+  // Blocks until the job finishes.  Only call this from a thread
+  // which is not one of the workers that run the jobs.
+  void wait() {
+    while (this->done == 0) {
+      syscall(SYS_futex, (int*)&this->done, FUTEX_WAIT_PRIVATE, 0, NULL, NULL, 0);
+    }
+  }
+
+  // Seconds the job waited in the queue, and ran.
+  double get_queue_time() const {
+    return this->start_time - this->submit_time;
+  }
+  double get_run_time() const {
+    return this->end_time - this->start_time;
+  }
+};
+
+
+class NabbitGraphScheduler {
+
+  struct Tenant {
+    double weight;
+    double virtual_time;
+    // Queues of jobs, indexed by the position of the priority in
+    // the priorities list.
+    std::vector<NabbitGraphFuture*> heads;
+    std::vector<NabbitGraphFuture*> tails;
+    int num_queued;
+    int num_running;
+  };
+
+ private:
+  int max_running;
+  volatile int lock;
+  std::vector<Tenant> tenants;
+  // Every priority we have seen, in decreasing order.
+  std::vector<int> priorities;
+  int num_queued;
+
+  static double now() {
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return NabbitTimers::tvToSec(tv);
+  }
+
+  void acquire() {
+    while (!__sync_bool_compare_and_swap(&this->lock, 0, 1)) {
+    }
+  }
+  void release() {
+    __sync_lock_release(&this->lock);
+  }
+
+  // Position of priority p in the priorities list, adding it (and a
+  // queue for it in every tenant) if it is new.
+  int priority_level(int p) {
+    size_t level = 0;
+    while ((level < this->priorities.size()) && (this->priorities[level] > p)) {
+      level++;
+    }
+    if ((level == this->priorities.size()) || (this->priorities[level] != p)) {
+      this->priorities.insert(this->priorities.begin() + level, p);
+      for (size_t t = 0; t < this->tenants.size(); t++) {
+	this->tenants[t].heads.insert(this->tenants[t].heads.begin() + level,
+				      (NabbitGraphFuture*)NULL);
+	this->tenants[t].tails.insert(this->tenants[t].tails.begin() + level,
+				      (NabbitGraphFuture*)NULL);
+      }
+    }
+    return (int)level;
+  }
+
+  // The smallest virtual time of a tenant with work, or -1.
+  double min_busy_virtual_time() {
+    double min_vt = -1;
+    for (size_t t = 0; t < this->tenants.size(); t++) {
+      Tenant* T = &this->tenants[t];
+      if ((T->num_queued + T->num_running > 0) &&
+	  ((min_vt < 0) || (T->virtual_time < min_vt))) {
+	min_vt = T->virtual_time;
+      }
+    }
+    return min_vt;
+  }
+
+  // Removes the next job from the queue, or returns NULL.  Must hold
+  // the lock.
+  NabbitGraphFuture* take_next() {
+    for (size_t level = 0; level < this->priorities.size(); level++) {
+      Tenant* best = NULL;
+      for (size_t t = 0; t < this->tenants.size(); t++) {
+	Tenant* T = &this->tenants[t];
+	if ((T->heads[level] != NULL) &&
+	    ((best == NULL) || (T->virtual_time < best->virtual_time))) {
+	  best = T;
+	}
+      }
+      if (best != NULL) {
+	NabbitGraphFuture* f = best->heads[level];
+	best->heads[level] = f->next;
+	if (f->next == NULL) {
+	  best->tails[level] = NULL;
+	}
+	f->next = NULL;
+	best->num_queued--;
+	best->num_running++;
+	this->num_queued--;
+	return f;
+      }
+    }
+    return NULL;
+  }
+
+  // Runs jobs until the queue is empty.
+  void run_slot() {
+    while (true) {
+      this->acquire();
+      NabbitGraphFuture* f = this->take_next();
+      this->release();
+      if (f == NULL) {
+	return;
+      }
+
+      f->start_time = now();
+      f->job->Run();
+      f->end_time = now();
+
+      this->acquire();
+      Tenant* T = &this->tenants[f->tenant];
+      T->virtual_time += f->get_run_time() / T->weight;
+      T->num_running--;
+      this->release();
+
+      // The future may be freed as soon as done is set.
+      __sync_lock_test_and_set(&f->done, 1);
+      syscall(SYS_futex, (int*)&f->done, FUTEX_WAKE_PRIVATE, INT_MAX, NULL, NULL, 0);
+    }
+  }
+
+ public:
+  // Runs at most max_running jobs at a time.
+  NabbitGraphScheduler(int max_running_)
+    : max_running(max_running_), lock(0), num_queued(0) {
+    assert(max_running > 0);
+  }
+
+  // Adds a tenant with the given share weight, and returns its id.
+  int add_tenant(double weight) {
+    assert(weight > 0);
+    this->acquire();
+    Tenant T;
+    T.weight = weight;
+    T.virtual_time = 0;
+    T.heads.assign(this->priorities.size(), (NabbitGraphFuture*)NULL);
+    T.tails.assign(this->priorities.size(), (NabbitGraphFuture*)NULL);
+    T.num_queued = 0;
+    T.num_running = 0;
+    this->tenants.push_back(T);
+    int id = (int)this->tenants.size() - 1;
+    this->release();
+    return id;
+  }
+
+  // Queues job for the tenant.  The caller keeps ownership of the
+  // job, and frees the future once it is done.
+  NabbitGraphFuture* submit(int tenant, NabbitGraphJob* job, int priority = 0) {
+    NabbitGraphFuture* f = new NabbitGraphFuture(job, tenant, priority);
+    f->submit_time = now();
+
+    this->acquire();
+    assert((tenant >= 0) && (tenant < (int)this->tenants.size()));
+    int level = this->priority_level(priority);
+    Tenant* T = &this->tenants[tenant];
+    if (T->num_queued + T->num_running == 0) {
+      double min_vt = this->min_busy_virtual_time();
+      if (min_vt > T->virtual_time) {
+	T->virtual_time = min_vt;
+      }
+    }
+    if (T->tails[level] == NULL) {
+      T->heads[level] = f;
+    }
+    else {
+      T->tails[level]->next = f;
+    }
+    T->tails[level] = f;
+    T->num_queued++;
+    this->num_queued++;
+    this->release();
+    return f;
+  }
+
+  int get_num_queued() const {
+    return this->num_queued;
+  }
+
+  double get_virtual_time(int tenant) {
+    this->acquire();
+    double vt = this->tenants[tenant].virtual_time;
+    this->release();
+    return vt;
+  }
+
+  // Runs jobs until none are left.  Call this from Cilk code.
+  void run() {
+    for (int i = 0; i < this->max_running; i++) {
+      cilk_spawn this->run_slot();
+    }
+    cilk_sync;
+  }
+};
+
+#endif
@@ -0,0 +1,144 @@
+// Code for the Nabbit task graph library
+//
+// Copyright (c) 2010 Jim Sukha
+//
+//
+/*
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use, copy,
+ * modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+
+
+
+#ifndef _NABBIT_INLINE_ARRAY_H_
+#define _NABBIT_INLINE_ARRAY_H_
+
+#include <assert.h>
+#include <stdio.h>
+#include <dag_status.h>
+#include <dynamic_array.h>
+
+
+/**********************************************
+ * Small-buffer arrays for node adjacency.
+ *
+ *  Most nodes have only a few predecessors and successors (e.g., 2
+ *  or 3 in a grid-shaped DAG).  A NabbitInlineArray stores the first
+ *  N elements inside the object itself, and only allocates a
+ *  DynamicArray for elements N and beyond.
+ *
+ *  The node types embed their adjacency arrays, so walking the
+ *  predecessors or successors of a low-degree node reads memory in
+ *  the node itself, instead of following a pointer to a heap-allocated
+ *  DynamicArray header and then to its buffer.
+ *
+ *  The interface is the subset of DynamicArray that the nodes use.
+ *  Like DynamicArray::add(), add() is not thread-safe: each array
+ *  must be filled by one strand, before it is shared.
+ */
+
+// Number of inline slots in the adjacency arrays of the node types.
+#ifndef NABBIT_INLINE_DEGREE
+#define NABBIT_INLINE_DEGREE 4
+#endif
+
+
+template <class T, int N>
+class NabbitInlineArray {
+
+ private:
+  T inline_slots[N];
+  int current_size;
+  DynamicArray<T>* overflow;
+
+ public:
+  NabbitInlineArray();
+  ~NabbitInlineArray();
+
+  int size_estimate();
+  T get(int idx);
+  void add(T val);
+
+  // Empties the array and frees any overflow storage.
+  void clear();
+
+  // True if no element has spilled out of the inline slots.
+  bool is_inline() { return this->overflow == NULL; }
+
+ private:
+  // Not copyable, since the nodes hand out pointers to their arrays.
+  NabbitInlineArray(const NabbitInlineArray&);
+  NabbitInlineArray& operator=(const NabbitInlineArray&);
+};
+
+
+template <class T, int N>
+NabbitInlineArray<T, N>::NabbitInlineArray()
+  : current_size(0),
+    overflow(NULL) {
+}
+
+template <class T, int N>
+NabbitInlineArray<T, N>::~NabbitInlineArray() {
+  this->clear();
+}
+
+template <class T, int N>
+int NabbitInlineArray<T, N>::size_estimate() {
+  return this->current_size;
+}
+
+template <class T, int N>
+T NabbitInlineArray<T, N>::get(int idx) {
+  if ((idx < 0) || (idx >= this->current_size)) {
+    return (T)0;
+  }
+  if (idx < N) {
+    return this->inline_slots[idx];
+  }
+  return this->overflow->get(idx - N);
+}
+
+template <class T, int N>
+void NabbitInlineArray<T, N>::add(T val) {
+  int idx = this->current_size;
+  if (idx < N) {
+    this->inline_slots[idx] = val;
+  }
+  else {
+    if (this->overflow == NULL) {
+      this->overflow = new DynamicArray<T>(N);
+    }
+    this->overflow->add(val);
+  }
+  this->current_size = idx + 1;
+}
+
+template <class T, int N>
+void NabbitInlineArray<T, N>::clear() {
+  if (this->overflow != NULL) {
+    delete this->overflow;
+    this->overflow = NULL;
+  }
+  this->current_size = 0;
+}
+
+#endif
@@ -0,0 +1,242 @@
+// Code for the Nabbit task graph library
+//
+// Copyright (c) 2010 Jim Sukha
+//
+//
+/*
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use, copy,
+ * modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+
+
+#ifndef _NABBIT_LEVEL_EXECUTOR_H_
+#define _NABBIT_LEVEL_EXECUTOR_H_
+
+#include <assert.h>
+#include <stdio.h>
+#include <vector>
+#include <dag_status.h>
+#include <dynamic_array.h>
+#include <static_nabbit_node.h>
+
+
+/**********************************************
+ * Level-synchronous execution of static DAGs.
+ *
+ *  The level of a node is the length of the longest path to it from
+ *  the source.  Every predecessor of a node is on an earlier level,
+ *  so we can run the DAG one level at a time, with a parallel loop
+ *  over each level and a sync between levels, like the pure
+ *  wavefront version of Smith-Waterman (sw_compute_pure_wavefront).
+ *  This uses no join counters and no atomics per edge, at the price
+ *  of one barrier per level, and of idle workers at the end of each
+ *  level.
+ *
+ *  For DAGs which are very wide and shallow, the per-edge atomics of
+ *  StaticNabbitNode dominate, and this is faster.  For deep or narrow
+ *  DAGs, the barriers dominate, and Nabbit is faster.  recommend(P)
+ *  gives a rough answer for a particular DAG.
+ *
+ *  NabbitLevelExecutor finds the DAG reachable from a source node,
+ *  and computes the levels once, in parallel, one level at a time:
+ *  each level is split over the workers like a node's successors in
+ *  notify_successors(), and a node goes on the next level when the
+ *  last of its predecessors is placed.  Nodes count their placed
+ *  predecessors in a field of their own, so finding the levels costs
+ *  one atomic increment per edge, once, and no lookups.  execute()
+ *  can then run the DAG any number of times.  It does not touch the
+ *  nodes' join counters, so the DAG can still be run with
+ *  source_compute() afterwards.
+ *
+ *  Nodes which fold their predecessors (e.g., StaticReductionNode)
+ *  fold all of them on their own strand, right before Compute(),
+ *  since every predecessor has finished by then.  The DAG must not
+ *  change while the executor is in use.
+ */
+
+// recommend(P) suggests this executor when the levels have at least
+// this many nodes per worker, on average.
+#ifndef NABBIT_LEVEL_MIN_WIDTH
+#define NABBIT_LEVEL_MIN_WIDTH 16
+#endif
+
+
+class NabbitLevelExecutor {
+
+ private:
+  // The nodes, sorted by level.  Level L is
+  // order[level_start[L] .. level_start[L+1]).
+  StaticNabbitNode** order;
+  int num_nodes;
+  std::vector<int> level_start;
+  int max_width;
+  volatile long long num_edges;
+
+  // Only used while computing the levels: the levels found so far,
+  // in order.
+  DynamicArray<StaticNabbitNode*>* placed;
+
+  // Places the successors of placed[start, end) whose last
+  // predecessor this is on the next level.
+  void place_successors(int start, int end) {
+    while (end - start > NABBIT_SPAWN_GRAIN) {
+      int mid = start + (end - start) / 2;
+      cilk_spawn this->place_successors(start, mid);
+      start = mid;
+    }
+    long long edges = 0;
+    for (int i = start; i < end; i++) {
+      StaticNabbitNode* v = this->placed->get(i);
+      edges += v->successors->size_estimate();
+      for (int j = 0; j < v->successors->size_estimate(); j++) {
+	StaticNabbitNode* s = v->successors->get(j);
+	if (__sync_add_and_fetch(&s->level_arrivals, 1) ==
+	    s->predecessors->size_estimate()) {
+	  bool success;
+	  do {
+	    success = this->placed->try_atomic_add(s);
+	  } while (!success);
+	}
+      }
+    }
+    __sync_add_and_fetch(&this->num_edges, edges);
+    cilk_sync;
+  }
+
+  // Copies placed[start, end) into order, and resets the arrival
+  // counts for the next executor.
+  void copy_placed(int start, int end) {
+    while (end - start > NABBIT_SPAWN_GRAIN) {
+      int mid = start + (end - start) / 2;
+      cilk_spawn this->copy_placed(start, mid);
+      start = mid;
+    }
+    for (int i = start; i < end; i++) {
+      this->order[i] = this->placed->get(i);
+      this->order[i]->level_arrivals = 0;
+    }
+    cilk_sync;
+  }
+
+  void compute_levels(StaticNabbitNode* source) {
+    // Every other node must have a predecessor.
+    assert(source->predecessors->size_estimate() == 0);
+
+    this->placed = new DynamicArray<StaticNabbitNode*>(1024);
+    this->placed->add(source);
+    this->level_start.push_back(0);
+    this->max_width = 0;
+    this->num_edges = 0;
+    int start = 0;
+    while (start < this->placed->size_estimate()) {
+      int end = this->placed->size_estimate();
+      this->level_start.push_back(end);
+      if (end - start > this->max_width) {
+	this->max_width = end - start;
+      }
+      this->place_successors(start, end);
+      start = end;
+    }
+
+    this->num_nodes = this->placed->size_estimate();
+    this->order = new StaticNabbitNode*[this->num_nodes];
+    this->copy_placed(0, this->num_nodes);
+    delete this->placed;
+    this->placed = NULL;
+  }
+
+  // Runs order[start, end), which are all on one level.
+  void run_range(int start, int end) {
+    while (end - start > NABBIT_SPAWN_GRAIN) {
+      int mid = start + (end - start) / 2;
+      cilk_spawn this->run_range(start, mid);
+      start = mid;
+    }
+    for (int i = start; i < end; i++) {
+      StaticNabbitNode* n = this->order[i];
+      if (n->folds_predecessors) {
+	for (int j = 0; j < n->predecessors->size_estimate(); j++) {
+	  n->FoldPredecessor(n->predecessors->get(j));
+	}
+      }
+      n->run_compute();
+    }
+    cilk_sync;
+  }
+
+ public:
+  // Finds the DAG reachable from source, and computes its levels.
+  // Every predecessor of a node must be reachable from source.
+  NabbitLevelExecutor(StaticNabbitNode* source)
+    : order(NULL), num_nodes(0), max_width(0), num_edges(0), placed(NULL) {
+    this->compute_levels(source);
+  }
+
+  ~NabbitLevelExecutor() {
+    delete[] this->order;
+  }
+
+  int get_num_nodes() const {
+    return this->num_nodes;
+  }
+  long long get_num_edges() const {
+    return this->num_edges;
+  }
+
+  // The number of levels, i.e., the number of nodes on a longest
+  // path.
+  int get_depth() const {
+    return (int)this->level_start.size() - 1;
+  }
+
+  // The number of nodes on the widest level.
+  int get_max_width() const {
+    return this->max_width;
+  }
+
+  int get_level_size(int L) const {
+    return this->level_start[L+1] - this->level_start[L];
+  }
+
+  // Node i of level L.
+  StaticNabbitNode* get_level_node(int L, int i) const {
+    assert((i >= 0) && (i < this->get_level_size(L)));
+    return this->order[this->level_start[L] + i];
+  }
+
+  // Whether this executor is likely to beat StaticNabbitNode on P
+  // workers: each level should keep every worker busy for long
+  // enough to pay for the sync at its end.  Computing the levels is
+  // a parallel pass, paid once, so it is left out.
+  bool recommend(int P) const {
+    return (long long)this->get_num_nodes() >=
+      (long long)this->get_depth() * P * NABBIT_LEVEL_MIN_WIDTH;
+  }
+
+  // Evaluates the DAG once, one level at a time.
+  void execute() {
+    for (int L = 0; L < this->get_depth(); L++) {
+      this->run_range(this->level_start[L], this->level_start[L+1]);
+    }
+  }
+};
+
+#endif
@@ -33,11 +33,16 @@
 //#include <cstdlib>
 //#include <iostream>
 #include <sys/time.h>
+#include <sched.h>
 #include <vector>
 #include <cilk.h>
 
 #include "nabbit_timers.h"
 
+#ifdef NABBIT_PERF_COUNTERS
+#include "nabbit_perf_counters.h"
+#endif
+
 
 /**********************************************
  * Module for logging in Nabbit. 
@@ -62,7 +67,15 @@
  *  There could be weirdness if worker threads get migrated between
  *  processors.  The code currently doesn't handle this case.  More
  *  post-processing work would need to be done to make this code more
- *  robust...
+ *  robust...  Pinning the workers avoids the problem (see
+ *  nabbit_affinity.h).  Each time record stores the CPU it was taken
+ *  on, and set_worker_cpu() records the CPU a worker was pinned to,
+ *  so the log shows whether any worker moved.
+ *
+ *  If compiled with -DNABBIT_PERF_COUNTERS, each node record also
+ *  stores the hardware counter deltas (cycles, instructions, LLC
+ *  misses, dTLB misses) measured by the computing worker between
+ *  start_noderec() and finish_noderec().  See nabbit_perf_counters.h.
  *
  *
  */
@@ -78,6 +91,9 @@ class NabbitNodeRecord {
   int compute_id;   // The id of the worker that computed the node.
   rTimeStruct start_ts;  // Starting timestamp.
   rTimeStruct end_ts;    // Ending timestamp.
+#ifdef NABBIT_PERF_COUNTERS
+  NabbitPerfSample perf; // Counter deltas between start and end.
+#endif
   RecType data;
 
   void core_print() {
@@ -85,6 +101,10 @@ class NabbitNodeRecord {
 	   this->compute_id,
 	   this->start_ts,
 	   this->end_ts - this->start_ts);
+#ifdef NABBIT_PERF_COUNTERS
+    printf(", ");
+    NabbitPerfCounters::print_sample(&this->perf);
+#endif
   }
 
   void print() {
@@ -95,6 +115,7 @@ class NabbitNodeRecord {
 
 struct NabbitTimeRecord {
   int proc_id;   // Processor id.
+  int cpu;       // The CPU we were running on, or -1.
   rTimeStruct ts_before; // Time stamp before.
   rTimeStruct ts_after;  // Time stamp after.  
   struct timeval tv;  // Time value from gettimeofday.
@@ -140,9 +161,15 @@ class NabbitTaskGraphStats {
   NabbitNodeBuffer* node_log;
   NabbitTimeBuffer* time_log;
   rTimeStruct* next_ts_limit;
+  // The CPU each worker is pinned to, or -1.
+  int* worker_cpu;
 
   volatile int time_barrier_counter;
 
+#ifdef NABBIT_PERF_COUNTERS
+  NabbitPerfCounters* perf_counters;
+#endif
+
   inline rTimeStruct get_next_ts_limit(int p) {
     return this->next_ts_limit[NEXT_TS_LIMIT_PADDING*p];
   }
@@ -169,6 +196,7 @@ class NabbitTaskGraphStats {
       assert(time_log);
 
       next_ts_limit = new rTimeStruct[NEXT_TS_LIMIT_PADDING*P];
+      worker_cpu = new int[P];
       
       for (int p = 0; p < P; p++) {
 	node_log[p] = new std::vector<NabbitNodeRecord<RecType> >;
@@ -177,7 +205,12 @@ class NabbitTaskGraphStats {
 	node_log[p]->clear();
 	time_log[p]->clear();
 	this->set_next_ts_limit(p, 0);
+	worker_cpu[p] = -1;
       }
+#ifdef NABBIT_PERF_COUNTERS
+      perf_counters = new NabbitPerfCounters(P);
+      assert(perf_counters);
+#endif
       printf("Finished creating TaskGraphStats for %d workers\n",
 	     this->P);
   }
@@ -189,6 +222,15 @@ class NabbitTaskGraphStats {
     return this->collection_enabled;
   }
 
+  // Records that worker p is pinned to the given CPU.
+  void set_worker_cpu(int p, int cpu) {
+    assert((p >= 0) && (p < P));
+    this->worker_cpu[p] = cpu;
+  }
+  inline int get_worker_cpu(int p) const {
+    return this->worker_cpu[p];
+  }
+
   inline int get_num_timerecs(int p) {
     return (int)time_log[p]->size();
   }
@@ -212,18 +254,20 @@ class NabbitTaskGraphStats {
   }
     
   void print_timelog(int proc_id) {
-    printf("Proc %d time log: length %zd\n",
+    printf("Proc %d time log: length %zd, pinned to CPU %d\n",
 	   proc_id,
-	   time_log[proc_id]->size());
+	   time_log[proc_id]->size(),
+	   worker_cpu[proc_id]);
 
     for (unsigned int k = 0; k < time_log[proc_id]->size(); ++k) {
       NabbitTimeRecord trec = time_log[proc_id]->at(k);
-      printf("%d: (%llu, %llu) (diff %llu) = %f\n",
+      printf("%d: (%llu, %llu) (diff %llu) = %f, cpu %d\n",
 	     k,
 	     trec.ts_before,
 	     trec.ts_after,
 	     trec.ts_after - trec.ts_before,
-	     1.0e6*trec.tv.tv_sec + trec.tv.tv_usec);
+	     1.0e6*trec.tv.tv_sec + trec.tv.tv_usec,
+	     trec.cpu);
     }
   }
 
@@ -253,9 +297,74 @@ class NabbitTaskGraphStats {
 
 
 
+  // Starts a record for a node computed by worker p.  Reads the
+  // cycle counter (and the hardware counters, if enabled).
+  inline void start_noderec(NabbitNodeRecord<RecType>* node_rec,
+			    int p) {
+    node_rec->compute_id = p;
+#ifdef NABBIT_PERF_COUNTERS
+    perf_counters->read(p, &node_rec->perf);
+#endif
+    NabbitTimers::cycleCounter(&node_rec->start_ts);
+  }
+
+  // Finishes a record started by start_noderec, and adds it to the
+  // log.
+  inline void finish_noderec(NabbitNodeRecord<RecType>* node_rec) {
+    NabbitTimers::cycleCounter(&node_rec->end_ts);
+#ifdef NABBIT_PERF_COUNTERS
+    {
+      NabbitPerfSample after;
+      // Counters from two different threads can't be subtracted.
+      // If the computation migrated, just record zeros.
+      if (cilk::current_worker_id() == node_rec->compute_id) {
+	perf_counters->read(node_rec->compute_id, &after);
+	NabbitPerfCounters::diff(&node_rec->perf, &after, &node_rec->perf);
+      }
+      else {
+	NabbitPerfCounters::clear(&node_rec->perf);
+      }
+    }
+#endif
+    add_noderec(node_rec);
+  }
+
+#ifdef NABBIT_PERF_COUNTERS
+  // Prints the total counts for each worker, and over all workers.
+  void print_perf_summary() {
+    NabbitPerfSample total;
+    NabbitPerfCounters::clear(&total);
+
+    for (int p = 0; p < P; p++) {
+      NabbitPerfSample proc_total;
+      NabbitPerfCounters::clear(&proc_total);
+      for (unsigned int k = 0; k < node_log[p]->size(); ++k) {
+	NabbitPerfCounters::accumulate(&proc_total,
+				       &(node_log[p]->at(k).perf));
+      }
+      printf("Proc %d perf (%zd nodes): ",
+	     p, node_log[p]->size());
+      NabbitPerfCounters::print_sample(&proc_total);
+      printf("\n");
+      NabbitPerfCounters::accumulate(&total, &proc_total);
+    }
+
+    printf("Total perf: ");
+    NabbitPerfCounters::print_sample(&total);
+    if (total.count[NABBIT_PERF_INSTRUCTIONS] > 0) {
+      double kinst = total.count[NABBIT_PERF_INSTRUCTIONS] / 1000.0;
+      printf(", LLC misses / 1000 inst = %f, dTLB misses / 1000 inst = %f",
+	     total.count[NABBIT_PERF_LLC_MISSES] / kinst,
+	     total.count[NABBIT_PERF_DTLB_MISSES] / kinst);
+    }
+    printf("\n");
+  }
+#endif
+
   void add_timerec(int p) {
     NabbitTimeRecord trec;
     trec.proc_id = p;
+    trec.cpu = sched_getcpu();
     NabbitTimers::cycleCounter(&trec.ts_before);
     gettimeofday(&trec.tv, NULL);
     NabbitTimers::cycleCounter(&trec.ts_after);
@@ -273,6 +382,10 @@ class NabbitTaskGraphStats {
     delete[] node_log;
     delete[] time_log;
     delete next_ts_limit;
+    delete[] worker_cpu;
+#ifdef NABBIT_PERF_COUNTERS
+    delete perf_counters;
+#endif
   }
 
 
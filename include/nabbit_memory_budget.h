@@ -0,0 +1,150 @@
+// Code for the Nabbit task graph library
+//
+// Copyright (c) 2010 Jim Sukha
+//
+//
+/*
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use, copy,
+ * modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+
+
+#ifndef _NABBIT_MEMORY_BUDGET_H_
+#define _NABBIT_MEMORY_BUDGET_H_
+
+#include <assert.h>
+#include <dag_status.h>
+
+
+/**********************************************
+ * Memory-aware execution order.
+ *
+ *  When nodes produce large outputs, the order in which we run
+ *  enabled nodes decides how many outputs are alive at once.  Nabbit
+ *  spawns the successors of a node in the order they were added, so
+ *  a wide DAG can start many branches, each holding the outputs of
+ *  its producers, before any of those outputs can be freed.
+ *
+ *  When compiled with -DNABBIT_MEMORY_AWARE, StaticNabbitNode tracks
+ *  the outputs of its nodes:
+ *
+ *   1. A node declares the size of its output with
+ *      set_output_bytes().  Once Compute() returns, the output counts
+ *      as live.
+ *   2. Once every successor of the node has finished Compute(), the
+ *      node's ReleaseOutput() is called (free the output there), and
+ *      the output stops counting as live.  Outputs of nodes without
+ *      successors stay live.
+ *   3. Among the successors a node enables, the one which frees the
+ *      most memory (the outputs it is the last consumer of, less its
+ *      own output) runs first, on the same worker, so execution goes
+ *      depth-first along consumers.  The others are spawned in the
+ *      same order, for thieves to take.
+ *   4. While the live bytes are over the soft cap, a node runs the
+ *      successors it enables one at a time instead of spawning them,
+ *      so it does not start new branches until memory is freed.  The
+ *      cap is soft: strands which are already running go on, and
+ *      live bytes can still go over it.
+ *
+ *  NabbitMemoryBudget::instance() keeps the live bytes, the peak, and
+ *  the soft cap (NABBIT_MEMORY_SOFT_CAP to start with, 0 for none).
+ *  Every output adds one atomic update of the live bytes, and every
+ *  edge out of a node with an output adds one atomic decrement.
+ */
+
+#ifndef NABBIT_MEMORY_SOFT_CAP
+#define NABBIT_MEMORY_SOFT_CAP 0
+#endif
+
+
+class NabbitMemoryBudget {
+
+ private:
+  // Updated by every worker, so each counter gets a cache line of
+  // its own.
+  char padding0[NABBIT_CACHE_LINE_SIZE];
+  volatile long long live_bytes;
+  char padding1[NABBIT_CACHE_LINE_SIZE - sizeof(long long)];
+  volatile long long peak_bytes;
+  char padding2[NABBIT_CACHE_LINE_SIZE - sizeof(long long)];
+  long long soft_cap;
+
+ public:
+  NabbitMemoryBudget()
+    : live_bytes(0), peak_bytes(0), soft_cap(NABBIT_MEMORY_SOFT_CAP) {
+  }
+
+  long long get_live_bytes() const {
+    return this->live_bytes;
+  }
+
+  // The largest number of live bytes since the last reset().
+  long long get_peak_bytes() const {
+    return this->peak_bytes;
+  }
+
+  long long get_soft_cap() const {
+    return this->soft_cap;
+  }
+
+  // Sets the soft cap, in bytes.  0 means no cap.
+  void set_soft_cap(long long bytes) {
+    this->soft_cap = (bytes > 0) ? bytes : 0;
+  }
+
+  // Forgets all live outputs, e.g., before running a DAG again.
+  void reset() {
+    this->live_bytes = 0;
+    this->peak_bytes = 0;
+  }
+
+  void add_live(long long bytes) {
+    long long live = __sync_add_and_fetch(&this->live_bytes, bytes);
+    long long peak = this->peak_bytes;
+    while ((live > peak) &&
+	   !__sync_bool_compare_and_swap(&this->peak_bytes, peak, live)) {
+      peak = this->peak_bytes;
+    }
+  }
+
+  void release(long long bytes) {
+    __sync_add_and_fetch(&this->live_bytes, -bytes);
+  }
+
+  inline bool over_cap() const {
+    return (this->soft_cap > 0) && (this->live_bytes > this->soft_cap);
+  }
+
+  static NabbitMemoryBudget* instance() {
+    static NabbitMemoryBudget* volatile the_budget = NULL;
+    if (the_budget == NULL) {
+      NabbitMemoryBudget* b = new NabbitMemoryBudget();
+      if (!__sync_bool_compare_and_swap(&the_budget,
+					(NabbitMemoryBudget*)NULL,
+					b)) {
+	delete b;
+      }
+    }
+    return the_budget;
+  }
+};
+
+#endif
@@ -0,0 +1,151 @@
+// Code for the Nabbit task graph library
+//
+// Copyright (c) 2010 Jim Sukha
+//
+//
+/*
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use, copy,
+ * modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+
+
+
+#ifndef _NABBIT_NODE_LAYOUT_H_
+#define _NABBIT_NODE_LAYOUT_H_
+
+#include <assert.h>
+#include <stdlib.h>
+#include <new>
+#include <dag_status.h>
+#include <nabbit_numa.h>
+
+
+/**********************************************
+ * Cache-line layout of nodes.
+ *
+ *  Programs often allocate their nodes in one array (e.g., the block
+ *  DAG in smith_waterman/SWDagParams.h).  Neighbouring nodes in such
+ *  an array usually finish on different workers, which then decrement
+ *  each other's join counters.  If those counters share a cache line,
+ *  the line ping-pongs between workers.
+ *
+ *  The parallel node types therefore group their fields in two parts:
+ *
+ *   1. Read-mostly fields (key, adjacency, table pointers), which are
+ *      written only while the node is built.
+ *   2. Scheduler state (join counter, status, successor list), which
+ *      other workers update while the DAG runs.
+ *
+ *  The scheduler state comes last, and is marked NABBIT_CACHE_ALIGNED.
+ *  Even without padding, this puts the read-mostly fields of a node
+ *  between its state and the state of the previous node in an array.
+ *
+ *  Compiling with -DNABBIT_PAD_NODE_STATE makes NABBIT_CACHE_ALIGNED
+ *  align the state to a cache line.  Every node then takes a whole
+ *  number of cache lines, and no two nodes share a line of scheduler
+ *  state.  This costs up to a cache line of padding per node.
+ *
+ *  Use nabbit_alloc_node_array() for arrays of nodes.  Plain new[]
+ *  does not respect the extra alignment.  Dynamic nodes come from
+ *  the slab allocator, which aligns blocks between 64 bytes and
+ *  NABBIT_SLAB_MAX_SIZE to a cache line.  Larger nodes, and all nodes
+ *  when the slab is disabled (NABBIT_DISABLE_SLAB_ALLOCATOR), come
+ *  from malloc, which only guarantees 16-byte alignment.
+ *
+ *  With -DNABBIT_NUMA_PLACEMENT, nabbit_alloc_node_array() also
+ *  spreads the array over the NUMA nodes before it constructs the
+ *  nodes (see nabbit_numa.h).
+ */
+
+#ifdef NABBIT_PAD_NODE_STATE
+#define NABBIT_CACHE_ALIGNED __attribute__((aligned(NABBIT_CACHE_LINE_SIZE)))
+#else
+#define NABBIT_CACHE_ALIGNED
+#endif
+
+
+// Allocates an array of n default-constructed nodes, starting on a
+// cache line.  Free it with nabbit_free_node_array().
+template <class T>
+T* nabbit_alloc_node_array(long long n) {
+  size_t alignment = NABBIT_CACHE_LINE_SIZE;
+  if (__alignof__(T) > alignment) {
+    alignment = __alignof__(T);
+  }
+
+  void* mem = NULL;
+  int err = posix_memalign(&mem, alignment, n * sizeof(T));
+  assert((err == 0) && (mem != NULL));
+#ifdef NABBIT_NUMA_PLACEMENT
+  nabbit_numa_place(mem, n * sizeof(T));
+#endif
+
+  T* a = (T*)mem;
+  for (long long i = 0; i < n; i++) {
+    new (&a[i]) T();
+  }
+  return a;
+}
+
+template <class T>
+void nabbit_free_node_array(T* a, long long n) {
+  for (long long i = 0; i < n; i++) {
+    a[i].~T();
+  }
+  free(a);
+}
+
+
+/**********************************************
+ * Prefetching successor state.
+ *
+ *  Notifying a successor decrements its join counter, which is
+ *  usually a cache miss on a large graph.  The notify loops prefetch
+ *  the state of the successors NABBIT_PREFETCH_DISTANCE entries ahead
+ *  of the one they are notifying, so these misses overlap.  (The
+ *  successor list of DynamicNabbitNode is a linked list, so it can
+ *  only look one cell ahead.)
+ *
+ *  The parallel node types also have a virtual PrefetchInputs(),
+ *  which a program can override to prefetch the data that Compute()
+ *  is about to read.  It is called on a successor as soon as it is
+ *  enabled.  The successor is spawned right after one more
+ *  notification (or at the end of the loop or batch), so a ready
+ *  successor is never held back by more than one edge.
+ *
+ *  Compile with -DNABBIT_PREFETCH_DISTANCE=0 to turn prefetching off.
+ *  Enabled successors are then spawned immediately, and
+ *  PrefetchInputs() is never called.
+ */
+
+#ifndef NABBIT_PREFETCH_DISTANCE
+#define NABBIT_PREFETCH_DISTANCE 4
+#endif
+
+#if NABBIT_PREFETCH_DISTANCE > 0
+#define NABBIT_PREFETCH_READ(addr) __builtin_prefetch((const void*)(addr), 0, 3)
+#define NABBIT_PREFETCH_WRITE(addr) __builtin_prefetch((const void*)(addr), 1, 3)
+#else
+#define NABBIT_PREFETCH_READ(addr)
+#define NABBIT_PREFETCH_WRITE(addr)
+#endif
+
+#endif
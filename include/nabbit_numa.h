@@ -0,0 +1,274 @@
+// Code for the Nabbit task graph library
+//
+// Copyright (c) 2010 Jim Sukha
+//
+//
+/*
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use, copy,
+ * modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+
+#ifndef _NABBIT_NUMA_H_
+#define _NABBIT_NUMA_H_
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <sched.h>
+#include <sys/syscall.h>
+#include <dag_status.h>
+
+
+/**********************************************
+ * NUMA placement of node arrays and block data.
+ *
+ *  Arrays are usually first touched by the serial code which builds
+ *  the DAG, so all of their pages end up on one socket, and every
+ *  other socket reads its blocks across the interconnect.
+ *
+ *  NabbitNumaTopology reads the NUMA nodes and their CPUs from
+ *  /sys/devices/system/node (no libnuma needed).  A machine without
+ *  that directory looks like a single node.
+ *
+ *  nabbit_numa_place(mem, bytes) splits a freshly allocated array into
+ *  one contiguous range per NUMA node, and binds range k to node k
+ *  with the mbind system call.  Pages then go to their node when they
+ *  are first touched, no matter which thread touches them.  For an
+ *  array in Morton order (e.g., the Smith-Waterman block DAG and its
+ *  NabbitArray2DMorton data), each range is a group of whole
+ *  quadrants, so every socket owns a compact region of the grid,
+ *  and most edges stay within a socket.  nabbit_numa_owner() gives
+ *  the node which owns an index.
+ *
+ *  If mbind is not available, nabbit_numa_place() instead touches the
+ *  pages in parallel, so they are spread over the sockets of the
+ *  workers that touch them, rather than all landing on one.
+ *
+ *  nabbit_alloc_node_array() places its memory before it constructs
+ *  the nodes when compiled with -DNABBIT_NUMA_PLACEMENT.  On a single
+ *  node, nabbit_numa_place() does nothing.
+ */
+
+#define NABBIT_NUMA_SYSFS_DIR "/sys/devices/system/node"
+
+// The largest number of NUMA nodes and CPUs we keep track of.
+#define NABBIT_NUMA_MAX_NODES 64
+#define NABBIT_NUMA_MAX_CPUS 4096
+
+// From <numaif.h>, which comes with libnuma.
+#define NABBIT_MPOL_PREFERRED 1
+
+
+// Parses a CPU list in the kernel's format (e.g., "0-3,8-11") into
+// cpus, which has room for max_cpus entries, in the order listed.
+// Returns the number of CPUs, or -1 if s is not a CPU list.
+inline int nabbit_parse_cpulist(const char* s, int* cpus, int max_cpus) {
+  int n = 0;
+  while ((*s == ' ') || (*s == '\n')) {
+    s++;
+  }
+  while (*s != '\0') {
+    char* end;
+    long lo = strtol(s, &end, 10);
+    if ((end == s) || (lo < 0)) {
+      return -1;
+    }
+    long hi = lo;
+    s = end;
+    if (*s == '-') {
+      hi = strtol(s + 1, &end, 10);
+      if ((end == s + 1) || (hi < lo)) {
+	return -1;
+      }
+      s = end;
+    }
+    for (long c = lo; (c <= hi) && (n < max_cpus); c++) {
+      cpus[n++] = (int)c;
+    }
+    if (*s == ',') {
+      s++;
+    }
+    else if ((*s != '\0') && (*s != '\n') && (*s != ' ')) {
+      return -1;
+    }
+    while ((*s == ' ') || (*s == '\n')) {
+      s++;
+    }
+  }
+  return n;
+}
+
+
+class NabbitNumaTopology {
+
+ private:
+  int num_nodes;
+  // node_ids[k] is the kernel's number for our k-th node.
+  int node_ids[NABBIT_NUMA_MAX_NODES];
+  // cpu_node[c] is our index for the node of CPU c, or -1.
+  int cpu_node[NABBIT_NUMA_MAX_CPUS];
+
+ public:
+  // Reads the topology under sysfs_dir, which has one directory
+  // nodeN/ with a cpulist file per NUMA node.
+  NabbitNumaTopology(const char* sysfs_dir = NABBIT_NUMA_SYSFS_DIR)
+    : num_nodes(0) {
+    for (int c = 0; c < NABBIT_NUMA_MAX_CPUS; c++) {
+      cpu_node[c] = -1;
+    }
+
+    char path[1024];
+    char line[4096];
+    int* cpus = new int[NABBIT_NUMA_MAX_CPUS];
+    for (int id = 0; (id < 1024) && (num_nodes < NABBIT_NUMA_MAX_NODES); id++) {
+      snprintf(path, sizeof(path), "%s/node%d/cpulist", sysfs_dir, id);
+      FILE* f = fopen(path, "r");
+      if (f == NULL) {
+	continue;
+      }
+      if (fgets(line, sizeof(line), f) != NULL) {
+	int n = nabbit_parse_cpulist(line, cpus, NABBIT_NUMA_MAX_CPUS);
+	for (int i = 0; i < n; i++) {
+	  if (cpus[i] < NABBIT_NUMA_MAX_CPUS) {
+	    cpu_node[cpus[i]] = num_nodes;
+	  }
+	}
+	node_ids[num_nodes] = id;
+	num_nodes++;
+      }
+      fclose(f);
+    }
+    delete[] cpus;
+
+    if (num_nodes == 0) {
+      num_nodes = 1;
+      node_ids[0] = 0;
+    }
+  }
+
+  int get_num_nodes() const {
+    return num_nodes;
+  }
+
+  // The kernel's number for node k.
+  int get_node_id(int k) const {
+    assert((k >= 0) && (k < num_nodes));
+    return node_ids[k];
+  }
+
+  // Our index for the node of the given CPU, or 0 if we do not know.
+  int node_of_cpu(int cpu) const {
+    if ((cpu < 0) || (cpu >= NABBIT_NUMA_MAX_CPUS) || (cpu_node[cpu] < 0)) {
+      return 0;
+    }
+    return cpu_node[cpu];
+  }
+
+  // The node of the CPU the calling thread is running on.
+  int current_node() const {
+    return node_of_cpu(sched_getcpu());
+  }
+
+  // The topology of this machine.  Read the first time it is needed,
+  // and never released.
+  static NabbitNumaTopology* instance() {
+    static NabbitNumaTopology* volatile the_topology = NULL;
+    if (the_topology == NULL) {
+      NabbitNumaTopology* t = new NabbitNumaTopology();
+      if (!__sync_bool_compare_and_swap(&the_topology,
+					(NabbitNumaTopology*)NULL,
+					t)) {
+	delete t;
+      }
+    }
+    return the_topology;
+  }
+};
+
+
+// The node which owns index idx of an array of n elements, when the
+// array is split into num_nodes contiguous ranges.
+inline int nabbit_numa_owner(long long idx, long long n, int num_nodes) {
+  assert((idx >= 0) && (idx < n));
+  return (int)((idx * num_nodes) / n);
+}
+
+
+// Touches one byte in every page of [start, end).
+inline void nabbit_numa_touch_pages(char* start, char* end, size_t page_size) {
+  while ((size_t)(end - start) > 64 * page_size) {
+    char* mid = start + (((end - start) / page_size) / 2) * page_size;
+    cilk_spawn nabbit_numa_touch_pages(start, mid, page_size);
+    start = mid;
+  }
+  for (char* p = start; p < end; p += page_size) {
+    *(volatile char*)p = 0;
+  }
+  cilk_sync;
+}
+
+
+// Binds range k of [mem, mem + bytes) to node k of T, before the
+// memory is touched.  Only the pages which lie entirely inside the
+// range are bound.  Returns true if every range was bound.
+inline bool nabbit_numa_bind(void* mem, size_t bytes, NabbitNumaTopology* T) {
+  size_t page_size = sysconf(_SC_PAGESIZE);
+  uintptr_t start = ((uintptr_t)mem + page_size - 1) & ~(uintptr_t)(page_size - 1);
+  uintptr_t end = ((uintptr_t)mem + bytes) & ~(uintptr_t)(page_size - 1);
+  if (end <= start) {
+    return true;
+  }
+
+  int k = T->get_num_nodes();
+  size_t num_pages = (end - start) / page_size;
+  for (int i = 0; i < k; i++) {
+    uintptr_t lo = start + ((num_pages * i) / k) * page_size;
+    uintptr_t hi = start + ((num_pages * (i+1)) / k) * page_size;
+    if (hi <= lo) {
+      continue;
+    }
+    int id = T->get_node_id(i);
+    unsigned long mask[1024 / (8 * sizeof(unsigned long))] = {0};
+    mask[id / (8 * sizeof(unsigned long))] |= 1UL << (id % (8 * sizeof(unsigned long)));
+    if (syscall(SYS_mbind, (void*)lo, hi - lo, NABBIT_MPOL_PREFERRED,
+		mask, 1024, 0) != 0) {
+      return false;
+    }
+  }
+  return true;
+}
+
+
+// Spreads freshly allocated memory over the NUMA nodes (see above).
+inline void nabbit_numa_place(void* mem, size_t bytes) {
+  NabbitNumaTopology* T = NabbitNumaTopology::instance();
+  if (T->get_num_nodes() <= 1) {
+    return;
+  }
+  if (!nabbit_numa_bind(mem, bytes, T)) {
+    size_t page_size = sysconf(_SC_PAGESIZE);
+    nabbit_numa_touch_pages((char*)mem, (char*)mem + bytes, page_size);
+  }
+}
+
+#endif
@@ -0,0 +1,273 @@
+// Code for the Nabbit task graph library
+//
+// Hardware performance counters for Nabbit.
+//
+// Copyright (c) 2010 Jim Sukha
+//
+//
+/*
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use, copy,
+ * modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+
+#ifndef _NABBIT_PERF_COUNTERS_H_
+#define _NABBIT_PERF_COUNTERS_H_
+
+#include <assert.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+
+
+/**********************************************
+ * Hardware performance counters for Nabbit.
+ *
+ *  NabbitPerfCounters keeps one perf_event group for each worker
+ *  thread.  A group counts cycles, instructions, last-level cache
+ *  misses and data TLB misses for the thread that opened it.  Reading
+ *  the group before and after a Compute() gives the counts for that
+ *  node.
+ *
+ *  perf_event_open counts events per thread, so the group for worker p
+ *  must be opened by worker p itself.  We open it lazily, the first
+ *  time worker p reads its counters.
+ *
+ *  If the kernel refuses to open the group leader (e.g., because of
+ *  /proc/sys/kernel/perf_event_paranoid), the counters for that
+ *  worker are disabled and every sample reads as zero.  Events other
+ *  than the leader which fail to open (e.g., dTLB events on some
+ *  virtual machines) also read as zero.
+ */
+
+typedef enum { NABBIT_PERF_CYCLES = 0,
+	       NABBIT_PERF_INSTRUCTIONS = 1,
+	       NABBIT_PERF_LLC_MISSES = 2,
+	       NABBIT_PERF_DTLB_MISSES = 3,
+	       NABBIT_PERF_NUM_EVENTS = 4 } NabbitPerfEvent;
+
+static const char* NabbitPerfEventNames[] = {
+  "cycles",
+  "instructions",
+  "LLC_misses",
+  "dTLB_misses",
+};
+
+
+// One reading (or difference of readings) of the counters.
+struct NabbitPerfSample {
+  unsigned long long count[NABBIT_PERF_NUM_EVENTS];
+};
+
+
+class NabbitPerfCounters {
+
+  // Status of the group for a worker.
+  typedef enum { PERF_UNOPENED = 0,
+		 PERF_OPEN = 1,
+		 PERF_FAILED = 2 } PerfGroupStatus;
+
+  // Each worker's state is padded out to its own cache line.
+  struct PerfWorkerState {
+    int fd[NABBIT_PERF_NUM_EVENTS];
+    // Position of each event in the group read, or -1 if the event
+    // is not being counted.
+    int group_pos[NABBIT_PERF_NUM_EVENTS];
+    int num_open;
+    PerfGroupStatus status;
+    char padding[64 - (2*NABBIT_PERF_NUM_EVENTS + 2)*sizeof(int)];
+  };
+
+ private:
+  int P;
+  PerfWorkerState* workers;
+  volatile int reported_failure;
+
+  static int perf_event_open(struct perf_event_attr* attr,
+			     int group_fd) {
+    // pid = 0, cpu = -1: count the calling thread on any processor.
+    return (int)syscall(__NR_perf_event_open, attr, 0, -1, group_fd, 0);
+  }
+
+  static void fill_attr(NabbitPerfEvent e,
+			struct perf_event_attr* attr) {
+    memset(attr, 0, sizeof(*attr));
+    attr->size = sizeof(*attr);
+    attr->exclude_kernel = 1;
+    attr->exclude_hv = 1;
+    attr->read_format = PERF_FORMAT_GROUP;
+
+    switch (e) {
+    case NABBIT_PERF_CYCLES:
+      attr->type = PERF_TYPE_HARDWARE;
+      attr->config = PERF_COUNT_HW_CPU_CYCLES;
+      break;
+    case NABBIT_PERF_INSTRUCTIONS:
+      attr->type = PERF_TYPE_HARDWARE;
+      attr->config = PERF_COUNT_HW_INSTRUCTIONS;
+      break;
+    case NABBIT_PERF_LLC_MISSES:
+      attr->type = PERF_TYPE_HW_CACHE;
+      attr->config = (PERF_COUNT_HW_CACHE_LL |
+		      (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+		      (PERF_COUNT_HW_CACHE_RESULT_MISS << 16));
+      break;
+    case NABBIT_PERF_DTLB_MISSES:
+      attr->type = PERF_TYPE_HW_CACHE;
+      attr->config = (PERF_COUNT_HW_CACHE_DTLB |
+		      (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+		      (PERF_COUNT_HW_CACHE_RESULT_MISS << 16));
+      break;
+    default:
+      assert(0);
+    }
+  }
+
+  // Opens the group for worker p.  Must be called by worker p.
+  void open_group(int p) {
+    PerfWorkerState* w = &workers[p];
+    struct perf_event_attr attr;
+
+    for (int e = 0; e < NABBIT_PERF_NUM_EVENTS; e++) {
+      w->fd[e] = -1;
+      w->group_pos[e] = -1;
+    }
+    w->num_open = 0;
+
+    for (int e = 0; e < NABBIT_PERF_NUM_EVENTS; e++) {
+      fill_attr((NabbitPerfEvent)e, &attr);
+      int leader_fd = (e == 0) ? -1 : w->fd[0];
+      w->fd[e] = perf_event_open(&attr, leader_fd);
+
+      if (w->fd[e] >= 0) {
+	w->group_pos[e] = w->num_open;
+	w->num_open++;
+      }
+      else if (e == 0) {
+	// Without a leader, there is no group to read.
+	if (__sync_bool_compare_and_swap(&this->reported_failure, 0, 1)) {
+	  printf("WARNING: perf_event_open failed on worker %d. Hardware counters disabled.\n",
+		 p);
+	}
+	w->status = PERF_FAILED;
+	return;
+      }
+    }
+    w->status = PERF_OPEN;
+  }
+
+ public:
+
+  // P is the number of worker threads we are running with.
+  NabbitPerfCounters(int P_) : P(P_), workers(NULL), reported_failure(0) {
+    assert(P > 0);
+    assert(sizeof(PerfWorkerState) == 64);
+    workers = new PerfWorkerState[P];
+    assert(workers);
+    for (int p = 0; p < P; p++) {
+      workers[p].status = PERF_UNOPENED;
+      workers[p].num_open = 0;
+      for (int e = 0; e < NABBIT_PERF_NUM_EVENTS; e++) {
+	workers[p].fd[e] = -1;
+	workers[p].group_pos[e] = -1;
+      }
+    }
+  }
+
+  ~NabbitPerfCounters() {
+    for (int p = 0; p < P; p++) {
+      for (int e = 0; e < NABBIT_PERF_NUM_EVENTS; e++) {
+	if (workers[p].fd[e] >= 0) {
+	  close(workers[p].fd[e]);
+	}
+      }
+    }
+    delete[] workers;
+  }
+
+  static inline void clear(NabbitPerfSample* sample) {
+    for (int e = 0; e < NABBIT_PERF_NUM_EVENTS; e++) {
+      sample->count[e] = 0;
+    }
+  }
+
+  // Stores after - before into result.  result may alias either
+  // argument.
+  static inline void diff(const NabbitPerfSample* before,
+			  const NabbitPerfSample* after,
+			  NabbitPerfSample* result) {
+    for (int e = 0; e < NABBIT_PERF_NUM_EVENTS; e++) {
+      result->count[e] = after->count[e] - before->count[e];
+    }
+  }
+
+  static inline void accumulate(NabbitPerfSample* total,
+				const NabbitPerfSample* sample) {
+    for (int e = 0; e < NABBIT_PERF_NUM_EVENTS; e++) {
+      total->count[e] += sample->count[e];
+    }
+  }
+
+  // Reads the current counter values for worker p.  This method
+  // should only be called by worker p.
+  //
+  // Returns false (and a zero sample) if counters are not available.
+  bool read(int p, NabbitPerfSample* sample) {
+    clear(sample);
+    if ((p < 0) || (p >= P)) {
+      return false;
+    }
+
+    PerfWorkerState* w = &workers[p];
+    if (w->status == PERF_UNOPENED) {
+      open_group(p);
+    }
+    if (w->status != PERF_OPEN) {
+      return false;
+    }
+
+    // Layout of a PERF_FORMAT_GROUP read: { nr, values[nr] }.
+    unsigned long long buf[1 + NABBIT_PERF_NUM_EVENTS];
+    ssize_t expected = (1 + w->num_open) * sizeof(unsigned long long);
+    if (::read(w->fd[0], buf, expected) != expected) {
+      return false;
+    }
+
+    for (int e = 0; e < NABBIT_PERF_NUM_EVENTS; e++) {
+      if (w->group_pos[e] >= 0) {
+	sample->count[e] = buf[1 + w->group_pos[e]];
+      }
+    }
+    return true;
+  }
+
+  static void print_sample(const NabbitPerfSample* sample) {
+    for (int e = 0; e < NABBIT_PERF_NUM_EVENTS; e++) {
+      printf("%s%s = %llu",
+	     (e > 0) ? ", " : "",
+	     NabbitPerfEventNames[e],
+	     sample->count[e]);
+    }
+  }
+};
+
+#endif
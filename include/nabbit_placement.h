@@ -0,0 +1,186 @@
+// Code for the Nabbit task graph library
+//
+// Copyright (c) 2010 Jim Sukha
+//
+//
+/*
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use, copy,
+ * modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+
+#ifndef _NABBIT_PLACEMENT_H_
+#define _NABBIT_PLACEMENT_H_
+
+#include <assert.h>
+#include <stdlib.h>
+#include <dag_status.h>
+#include <nabbit_slab_allocator.h>
+
+
+/**********************************************
+ * Locality-aware placement of enabled nodes.
+ *
+ *  A node runs on the worker which enables it, i.e., whichever
+ *  predecessor happened to finish last.  If most of the node's input
+ *  was written by a different predecessor (e.g., the long column of
+ *  the left neighbour of a tall Smith-Waterman block), that data is
+ *  usually still in the other worker's cache.
+ *
+ *  Programs can give each edge a weight, the number of bytes the
+ *  successor reads from the predecessor (add_dep(pred, bytes) on
+ *  StaticNabbitNode).  Each node remembers which worker ran it.
+ *  When compiled with -DNABBIT_LOCALITY_PLACEMENT, a worker which
+ *  enables a node whose heaviest input was produced by some other
+ *  worker posts the node to that worker's mailbox, instead of
+ *  spawning it.
+ *
+ *  Cilk does not let us push work onto another worker's deque, so
+ *  the mailbox is only a hint:
+ *
+ *   1. Each worker empties its mailbox every time it finishes a
+ *      Compute(), and spawns the nodes it finds there.
+ *   2. The worker which posted a node keeps its own reference to
+ *      it.  When it reaches the end of its notify loop, before its
+ *      cilk_sync, it spawns every node it posted which the owner has
+ *      not taken yet.
+ *
+ *  Exactly one of the two claims each posted node (a CAS on the
+ *  cell), and the cell is freed once both have let go of it.  A
+ *  posted node therefore waits at most until the poster's notify
+ *  loop ends, and the DAG still finishes when the owner is busy or
+ *  idle.
+ *
+ *  The owner spawns the nodes it claims inside whichever node it just
+ *  computed, so the only guarantee that a posted node finishes before
+ *  source_compute() returns is that both nodes belong to the same
+ *  DAG.  Only use NABBIT_LOCALITY_PLACEMENT when one DAG runs at a
+ *  time.
+ */
+
+struct NabbitMailCell {
+  void* item;
+  // Links the cell into the owner's mailbox.
+  NabbitMailCell* next;
+  // Links the cell into the poster's list of its posts.
+  NabbitMailCell* poster_next;
+  volatile int claimed;
+  // Starts at 2: one for the owner, one for the poster.
+  volatile int refs;
+
+  NabbitMailCell(void* item_)
+    : item(item_), next(NULL), poster_next(NULL), claimed(0), refs(2) { }
+
+  // Returns true for exactly one of the owner and the poster.
+  inline bool claim() {
+    return (this->claimed == 0) &&
+      __sync_bool_compare_and_swap(&this->claimed, 0, 1);
+  }
+
+  // Called once by the owner and once by the poster.
+  inline void release() {
+    if (__sync_add_and_fetch(&this->refs, -1) == 0) {
+      delete this;
+    }
+  }
+
+  NABBIT_SLAB_ALLOCATED
+};
+
+
+class NabbitMailboxes {
+
+  // Each worker's mailbox is on its own cache line.
+  struct Mailbox {
+    NabbitMailCell* volatile head;
+    char padding[NABBIT_CACHE_LINE_SIZE - sizeof(NabbitMailCell*)];
+  };
+
+ private:
+  int P;
+  Mailbox* boxes;
+
+ public:
+  NabbitMailboxes(int P_) : P(P_), boxes(NULL) {
+    assert(P > 0);
+    void* mem = NULL;
+    int err = posix_memalign(&mem, NABBIT_CACHE_LINE_SIZE, P * sizeof(Mailbox));
+    assert(err == 0);
+    boxes = (Mailbox*)mem;
+    for (int p = 0; p < P; p++) {
+      boxes[p].head = NULL;
+    }
+  }
+
+  // Cells still in a mailbox have already been claimed by their
+  // poster, which has let go of them.
+  ~NabbitMailboxes() {
+    for (int p = 0; p < P; p++) {
+      NabbitMailCell* c = take_all(p);
+      while (c != NULL) {
+	NabbitMailCell* next = c->next;
+	c->release();
+	c = next;
+      }
+    }
+    free(boxes);
+  }
+
+  int get_num_workers() const {
+    return P;
+  }
+
+  // Pushes c onto the mailbox of worker p.  Safe from any thread.
+  void post(int p, NabbitMailCell* c) {
+    assert((p >= 0) && (p < P));
+    NabbitMailCell* old_head;
+    do {
+      old_head = boxes[p].head;
+      c->next = old_head;
+    } while (!__sync_bool_compare_and_swap(&boxes[p].head, old_head, c));
+  }
+
+  // Empties the mailbox of worker p, and returns its cells (most
+  // recently posted first).  Only worker p should call this.
+  NabbitMailCell* take_all(int p) {
+    assert((p >= 0) && (p < P));
+    if (boxes[p].head == NULL) {
+      return NULL;
+    }
+    return __sync_lock_test_and_set(&boxes[p].head, (NabbitMailCell*)NULL);
+  }
+
+  // The mailboxes of the Cilk workers.  Created the first time they
+  // are needed, and never released.
+  static NabbitMailboxes* instance() {
+    static NabbitMailboxes* volatile the_mailboxes = NULL;
+    if (the_mailboxes == NULL) {
+      NabbitMailboxes* m = new NabbitMailboxes(__cilkrts_get_nworkers());
+      if (!__sync_bool_compare_and_swap(&the_mailboxes,
+					(NabbitMailboxes*)NULL,
+					m)) {
+	delete m;
+      }
+    }
+    return the_mailboxes;
+  }
+};
+
+#endif
@@ -0,0 +1,195 @@
+// Code for the Nabbit task graph library
+//
+// Copyright (c) 2010 Jim Sukha
+//
+//
+/*
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use, copy,
+ * modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef __NABBIT_REDUCTION_NODE_H_
+#define __NABBIT_REDUCTION_NODE_H_
+
+#include <assert.h>
+#include <stdlib.h>
+#include <new>
+
+#include <dag_status.h>
+#include <static_nabbit_node.h>
+
+
+/**
+ * Static Nabbit nodes which reduce the values of their predecessors.
+ *
+ * Many nodes just combine the results of their predecessors with an
+ * associative operator.  A plain StaticNabbitNode does this with a
+ * serial loop over its predecessors in Compute(), which adds O(d) to
+ * the span for a node with in-degree d.
+ *
+ * A StaticReductionNode<Monoid> instead folds in the value of each
+ * predecessor as soon as that predecessor finishes, on the worker
+ * which ran it.  Each worker has its own partial result (padded out
+ * to a cache line), so folds never synchronize.  Compute() then calls
+ * reduced_value(), which merges the O(P) partials.
+ *
+ * A Monoid is a class with:
+ *
+ *   typedef ... value_type;
+ *   static value_type identity();
+ *   static value_type combine(value_type a, value_type b);
+ *
+ * Predecessors finish in no particular order, so combine() must be
+ * commutative as well as associative.
+ *
+ * Subclasses implement PredecessorValue(pred), the value pred
+ * contributes, and Compute(), which should call reduced_value()
+ * exactly once.  reduced_value() resets the partials, so the node
+ * can be run again after init_node().
+ */
+
+
+// The sum of values of type T.
+template <class T>
+struct NabbitSumMonoid {
+  typedef T value_type;
+  static T identity() { return T(0); }
+  static T combine(T a, T b) { return a + b; }
+};
+
+
+template <class Monoid>
+class StaticReductionNode: public StaticNabbitNode {
+
+ public:
+  typedef typename Monoid::value_type value_type;
+
+  StaticReductionNode(long long k);
+  StaticReductionNode(long long k, int num_predecessors);
+  ~StaticReductionNode();
+
+ protected:
+  // The value that pred contributes to the reduction.  Called once
+  // for each predecessor, after its Compute() has returned.
+  virtual value_type PredecessorValue(StaticNabbitNode* pred) = 0;
+
+  // Returns the reduction of the values of all predecessors (the
+  // identity for a node without any), and resets the partials.  Only
+  // call this from Compute().
+  value_type reduced_value();
+
+ private:
+  // Each partial gets its own cache line.
+  struct Partial {
+    value_type value;
+  } __attribute__((aligned(NABBIT_CACHE_LINE_SIZE)));
+
+  // partials[P] is shared by threads which are not Cilk workers, and
+  // protected by shared_lock.
+  int P;
+  Partial* partials;
+  volatile int shared_lock;
+
+  void alloc_partials();
+  void FoldPredecessor(StaticNabbitNode* pred);
+};
+
+
+template <class Monoid>
+StaticReductionNode<Monoid>::StaticReductionNode(long long k)
+  : StaticNabbitNode(k),
+    P(0),
+    partials(NULL),
+    shared_lock(0) {
+  this->alloc_partials();
+}
+
+template <class Monoid>
+StaticReductionNode<Monoid>::StaticReductionNode(long long k,
+						 int num_predecessors)
+  : StaticNabbitNode(k, num_predecessors),
+    P(0),
+    partials(NULL),
+    shared_lock(0) {
+  this->alloc_partials();
+}
+
+template <class Monoid>
+StaticReductionNode<Monoid>::~StaticReductionNode() {
+  for (int p = 0; p <= P; p++) {
+    partials[p].~Partial();
+  }
+  free(partials);
+}
+
+
+template <class Monoid>
+void StaticReductionNode<Monoid>::alloc_partials() {
+  this->P = __cilkrts_get_nworkers();
+  assert(this->P > 0);
+
+  void* mem = NULL;
+  int err = posix_memalign(&mem,
+			   NABBIT_CACHE_LINE_SIZE,
+			   (P+1) * sizeof(Partial));
+  assert((err == 0) && (mem != NULL));
+  this->partials = (Partial*)mem;
+  for (int p = 0; p <= P; p++) {
+    new (&this->partials[p]) Partial();
+    this->partials[p].value = Monoid::identity();
+  }
+  this->folds_predecessors = true;
+}
+
+
+// Runs on the worker which finished pred.  A worker runs one strand
+// at a time, and this method does not spawn, so no other fold can
+// touch the same partial in the meantime.
+template <class Monoid>
+void StaticReductionNode<Monoid>::FoldPredecessor(StaticNabbitNode* pred) {
+  value_type v = this->PredecessorValue(pred);
+  int p = GET_WORKER_ID;
+  if ((p >= 0) && (p < P)) {
+    partials[p].value = Monoid::combine(partials[p].value, v);
+  }
+  else {
+    while (!__sync_bool_compare_and_swap(&shared_lock, 0, 1)) {
+    }
+    partials[P].value = Monoid::combine(partials[P].value, v);
+    __sync_lock_release(&shared_lock);
+  }
+}
+
+
+// The join counter has reached 0, and the acquire in that decrement
+// makes every fold visible here.
+template <class Monoid>
+typename StaticReductionNode<Monoid>::value_type
+StaticReductionNode<Monoid>::reduced_value() {
+  value_type result = Monoid::identity();
+  for (int p = 0; p <= P; p++) {
+    result = Monoid::combine(result, partials[p].value);
+    partials[p].value = Monoid::identity();
+  }
+  return result;
+}
+
+
+#endif
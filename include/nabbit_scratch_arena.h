@@ -0,0 +1,238 @@
+// Code for the Nabbit task graph library
+//
+// Copyright (c) 2010 Jim Sukha
+//
+//
+/*
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use, copy,
+ * modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+
+
+#ifndef _NABBIT_SCRATCH_ARENA_H_
+#define _NABBIT_SCRATCH_ARENA_H_
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <dag_status.h>
+
+
+/**********************************************
+ * Scratch memory for Compute().
+ *
+ *  Every node type has a protected method scratch(bytes), which
+ *  returns temporary memory for the current Compute() call (e.g.,
+ *  halo rows and columns, or space for a reduction).  The memory is
+ *  released automatically when Compute() returns, so there is no
+ *  matching free.
+ *
+ *  Each call to Compute() gets its own NabbitScratchArena, which
+ *  bump-allocates out of 64 KB chunks.  Chunks come from a per-worker
+ *  pool, and go back to the pool of the worker which finishes the
+ *  node.  The pool hands out the most recently returned chunk first,
+ *  so scratch memory is usually still in the worker's cache.  Neither
+ *  the arena nor the pool takes a lock on a Cilk worker.
+ *
+ *  Restriction: scratch() may only be called from the Compute() strand
+ *  itself, not from strands that Compute() spawns, because the arena
+ *  is not thread-safe.  Spawned children can use memory that the
+ *  parent allocated before spawning them.
+ */
+
+#define NABBIT_SCRATCH_CHUNK_SIZE (64 * 1024)
+#define NABBIT_SCRATCH_ALIGNMENT 16
+
+// A worker keeps at most this many free chunks in its pool.
+#define NABBIT_SCRATCH_MAX_FREE_CHUNKS 16
+
+
+// The chunk header takes up the first cache line of each chunk.
+struct NabbitScratchChunk {
+  NabbitScratchChunk* next;
+  size_t size;
+  char padding[64 - sizeof(NabbitScratchChunk*) - sizeof(size_t)];
+};
+
+
+class NabbitScratchPool {
+
+  // Each worker's state is padded out to its own cache line.
+  struct ScratchWorkerState {
+    NabbitScratchChunk* free_chunks;
+    int num_free;
+    volatile int lock;
+    char padding[64 - sizeof(NabbitScratchChunk*) - 2*sizeof(int)];
+  };
+
+ private:
+  // workers[P] is the shared slot for threads which are not workers.
+  int P;
+  ScratchWorkerState* workers;
+
+  inline int acquire_slot() {
+    int p = GET_WORKER_ID;
+    if ((p < 0) || (p >= P)) {
+      p = P;
+      while (!__sync_bool_compare_and_swap(&workers[P].lock, 0, 1)) {
+      }
+    }
+    return p;
+  }
+
+  inline void release_slot(int p) {
+    if (p == P) {
+      __sync_lock_release(&workers[P].lock);
+    }
+  }
+
+  static NabbitScratchChunk* new_chunk(size_t size) {
+    void* mem = NULL;
+    int err = posix_memalign(&mem, 64, size);
+    assert(err == 0);
+    NabbitScratchChunk* c = (NabbitScratchChunk*)mem;
+    c->next = NULL;
+    c->size = size;
+    return c;
+  }
+
+ public:
+  NabbitScratchPool(int P_) : P(P_), workers(NULL) {
+    assert(P > 0);
+    assert(sizeof(ScratchWorkerState) == 64);
+    assert(sizeof(NabbitScratchChunk) == 64);
+    workers = new ScratchWorkerState[P+1];
+    for (int p = 0; p <= P; p++) {
+      workers[p].free_chunks = NULL;
+      workers[p].num_free = 0;
+      workers[p].lock = 0;
+    }
+  }
+
+  ~NabbitScratchPool() {
+    for (int p = 0; p <= P; p++) {
+      NabbitScratchChunk* c = workers[p].free_chunks;
+      while (c != NULL) {
+	NabbitScratchChunk* next = c->next;
+	free(c);
+	c = next;
+      }
+    }
+    delete[] workers;
+  }
+
+  // Returns a chunk with room for at least bytes bytes of data.
+  NabbitScratchChunk* get_chunk(size_t bytes) {
+    if (bytes + sizeof(NabbitScratchChunk) > NABBIT_SCRATCH_CHUNK_SIZE) {
+      return new_chunk(bytes + sizeof(NabbitScratchChunk));
+    }
+
+    NabbitScratchChunk* c = NULL;
+    int p = acquire_slot();
+    if (workers[p].free_chunks != NULL) {
+      c = workers[p].free_chunks;
+      workers[p].free_chunks = c->next;
+      workers[p].num_free--;
+    }
+    release_slot(p);
+
+    if (c == NULL) {
+      c = new_chunk(NABBIT_SCRATCH_CHUNK_SIZE);
+    }
+    c->next = NULL;
+    return c;
+  }
+
+  void put_chunk(NabbitScratchChunk* c) {
+    if (c->size != NABBIT_SCRATCH_CHUNK_SIZE) {
+      free(c);
+      return;
+    }
+
+    int p = acquire_slot();
+    if (workers[p].num_free < NABBIT_SCRATCH_MAX_FREE_CHUNKS) {
+      c->next = workers[p].free_chunks;
+      workers[p].free_chunks = c;
+      workers[p].num_free++;
+      c = NULL;
+    }
+    release_slot(p);
+
+    if (c != NULL) {
+      free(c);
+    }
+  }
+
+  // The pool used by the library.  Created the first time it is
+  // needed, with one slot per Cilk worker.
+  static NabbitScratchPool* instance() {
+    static NabbitScratchPool* volatile the_pool = NULL;
+    if (the_pool == NULL) {
+      NabbitScratchPool* pool = new NabbitScratchPool(__cilkrts_get_nworkers());
+      if (!__sync_bool_compare_and_swap(&the_pool,
+					(NabbitScratchPool*)NULL,
+					pool)) {
+	delete pool;
+      }
+    }
+    return the_pool;
+  }
+};
+
+
+// The scratch memory for one Compute() call.  Destroying the arena
+// returns all its chunks to the pool.
+class NabbitScratchArena {
+
+ private:
+  NabbitScratchChunk* chunks;
+  char* bump;
+  char* end;
+
+ public:
+  NabbitScratchArena() : chunks(NULL), bump(NULL), end(NULL) { }
+
+  ~NabbitScratchArena() {
+    NabbitScratchChunk* c = chunks;
+    while (c != NULL) {
+      NabbitScratchChunk* next = c->next;
+      NabbitScratchPool::instance()->put_chunk(c);
+      c = next;
+    }
+  }
+
+  void* alloc(size_t bytes) {
+    bytes = (bytes + NABBIT_SCRATCH_ALIGNMENT - 1) & ~((size_t)NABBIT_SCRATCH_ALIGNMENT - 1);
+    if ((bump == NULL) || (bump + bytes > end)) {
+      NabbitScratchChunk* c = NabbitScratchPool::instance()->get_chunk(bytes);
+      c->next = chunks;
+      chunks = c;
+      bump = (char*)c + sizeof(NabbitScratchChunk);
+      end = (char*)c + c->size;
+    }
+    void* ptr = (void*)bump;
+    bump += bytes;
+    return ptr;
+  }
+};
+
+
+#endif
@@ -0,0 +1,350 @@
+// Code for the Nabbit task graph library
+//
+// Copyright (c) 2010 Jim Sukha
+//
+//
+/*
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use, copy,
+ * modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+
+
+#ifndef _NABBIT_SLAB_ALLOCATOR_H_
+#define _NABBIT_SLAB_ALLOCATOR_H_
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <dag_status.h>
+
+
+/**********************************************
+ * Per-worker slab allocation for Nabbit's internal objects.
+ *
+ *  The library allocates many small objects on its hot paths: list
+ *  nodes in the hash tables, DynamicArray objects and their buffers,
+ *  successor-list cells, and dynamic nodes.  Allocating all of them
+ *  from a single malloc does not scale (see
+ *  misc_tests/malloc_test.cilk).
+ *
+ *  NabbitSlabAllocator rounds each request up to a power-of-two size
+ *  class between 16 and 4096 bytes.  Each worker keeps its own free
+ *  list for each size class, and carves new blocks out of its own
+ *  64 KB chunks, so allocation and free never synchronize.  Requests
+ *  larger than the largest size class go to malloc.
+ *
+ *  Chunks are aligned to their own size, and blocks of 64 bytes or
+ *  more are aligned to a cache line, so a small object never
+ *  straddles two lines and a node's state can be padded out to its
+ *  own line (see nabbit_node_layout.h).
+ *
+ *  Blocks have no header, so the caller must pass the size of the
+ *  block back to free().  Class-specific operator delete gets this
+ *  size for free (see NABBIT_SLAB_ALLOCATED below).  The header at
+ *  the start of each chunk records the allocator which owns it, so
+ *  nabbit_slab_free() can return a block to the right allocator
+ *  without being told which one that is.
+ *
+ *  A block freed by a different worker than the one that allocated it
+ *  goes onto the freeing worker's list.  Threads which are not Cilk
+ *  workers share one extra slot, protected by a lock.
+ *
+ *  Each task graph owns its own allocator (see
+ *  TaskGraphHashTable::get_slab()), which returns all of its chunks
+ *  to the system when the graph is destroyed.  Only objects
+ *  allocated from that pool are released with the graph: nodes
+ *  created with "new (pool)", the cells and arrays dynamic nodes
+ *  allocate for themselves, and DynamicArrays given the pool.
+ *  Everything allocated without a pool comes from a default
+ *  allocator, which is never released.  This includes the list
+ *  nodes of ConcurrentHashTable and SplitOrderedHashTable, epoch
+ *  reclaimer items, mail cells (nabbit_placement.h), and
+ *  DynamicArrays created without a pool.  Their blocks go back to
+ *  the default allocator's free lists when they are deleted.
+ *
+ *  Compile with -DNABBIT_DISABLE_SLAB_ALLOCATOR to send every
+ *  allocation to malloc instead.
+ */
+
+#define NABBIT_SLAB_MIN_SHIFT 4
+#define NABBIT_SLAB_NUM_CLASSES 9
+#define NABBIT_SLAB_MAX_SIZE (1 << (NABBIT_SLAB_MIN_SHIFT + NABBIT_SLAB_NUM_CLASSES - 1))
+#define NABBIT_SLAB_CHUNK_SIZE (64 * 1024)
+
+
+struct NabbitSlabFreeBlock {
+  NabbitSlabFreeBlock* next;
+};
+
+class NabbitSlabAllocator;
+
+// Each chunk starts with a header, so we can find all the chunks
+// again in release_all(), and find the owner of a block from its
+// address.
+struct NabbitSlabChunk {
+  NabbitSlabChunk* next;
+  NabbitSlabAllocator* owner;
+};
+
+
+class NabbitSlabAllocator {
+
+  // Each worker's state is padded out to its own cache lines.
+  struct SlabWorkerState {
+    NabbitSlabFreeBlock* free_lists[NABBIT_SLAB_NUM_CLASSES];
+    char* bump;
+    char* bump_end;
+    NabbitSlabChunk* chunks;
+    volatile int lock;
+    char padding[128
+		 - (NABBIT_SLAB_NUM_CLASSES + 3) * sizeof(void*)
+		 - sizeof(int)];
+  };
+
+ private:
+  // workers[P] is the shared slot for threads which are not workers.
+  int P;
+  SlabWorkerState* workers;
+
+
+  static inline int size_class(size_t bytes) {
+    int c = 0;
+    size_t class_size = (1 << NABBIT_SLAB_MIN_SHIFT);
+    while (class_size < bytes) {
+      class_size *= 2;
+      c++;
+    }
+    return c;
+  }
+
+  static inline size_t class_size(int c) {
+    return ((size_t)1 << (NABBIT_SLAB_MIN_SHIFT + c));
+  }
+
+  // Returns the slot for the calling thread, locking it if it is the
+  // shared slot.
+  inline int acquire_slot() {
+    int p = GET_WORKER_ID;
+    if ((p < 0) || (p >= P)) {
+      p = P;
+      while (!__sync_bool_compare_and_swap(&workers[P].lock, 0, 1)) {
+      }
+    }
+    return p;
+  }
+
+  inline void release_slot(int p) {
+    if (p == P) {
+      __sync_lock_release(&workers[P].lock);
+    }
+  }
+
+  // Rounds the bump pointer up to the alignment for a block of the
+  // given size: the size itself, up to a cache line.
+  static inline char* align_block(char* ptr, size_t bytes) {
+    size_t alignment = (bytes < NABBIT_CACHE_LINE_SIZE) ? bytes : NABBIT_CACHE_LINE_SIZE;
+    return (char*)(((size_t)ptr + alignment - 1) & ~(alignment - 1));
+  }
+
+  // Carves a block of class c out of the current chunk of slot p,
+  // starting a new chunk if needed.
+  void* bump_alloc(int p, int c) {
+    SlabWorkerState* w = &workers[p];
+    size_t bytes = class_size(c);
+    char* block = (w->bump == NULL) ? NULL : align_block(w->bump, bytes);
+    if ((block == NULL) || (block + bytes > w->bump_end)) {
+      void* mem = NULL;
+      int err = posix_memalign(&mem, NABBIT_SLAB_CHUNK_SIZE, NABBIT_SLAB_CHUNK_SIZE);
+      assert((err == 0) && (mem != NULL));
+      NabbitSlabChunk* chunk = (NabbitSlabChunk*)mem;
+      chunk->next = w->chunks;
+      chunk->owner = this;
+      w->chunks = chunk;
+      w->bump_end = (char*)chunk + NABBIT_SLAB_CHUNK_SIZE;
+      block = align_block((char*)chunk + sizeof(NabbitSlabChunk), bytes);
+    }
+    w->bump = block + bytes;
+    return (void*)block;
+  }
+
+  void reset_slot(int p) {
+    SlabWorkerState* w = &workers[p];
+    for (int c = 0; c < NABBIT_SLAB_NUM_CLASSES; c++) {
+      w->free_lists[c] = NULL;
+    }
+    w->bump = NULL;
+    w->bump_end = NULL;
+    w->chunks = NULL;
+    w->lock = 0;
+  }
+
+ public:
+
+  // P is the number of worker threads we are running with.
+  NabbitSlabAllocator(int P_) : P(P_), workers(NULL) {
+    assert(P > 0);
+    assert(sizeof(SlabWorkerState) == 128);
+    workers = (SlabWorkerState*)malloc((P+1) * sizeof(SlabWorkerState));
+    assert(workers);
+    for (int p = 0; p <= P; p++) {
+      reset_slot(p);
+    }
+  }
+
+  ~NabbitSlabAllocator() {
+    release_all();
+    free(workers);
+  }
+
+
+  void* alloc(size_t bytes) {
+    if (bytes > NABBIT_SLAB_MAX_SIZE) {
+      return malloc(bytes);
+    }
+
+    int c = size_class(bytes);
+    int p = acquire_slot();
+    SlabWorkerState* w = &workers[p];
+    void* block;
+    if (w->free_lists[c] != NULL) {
+      block = (void*)w->free_lists[c];
+      w->free_lists[c] = w->free_lists[c]->next;
+    }
+    else {
+      block = bump_alloc(p, c);
+    }
+    release_slot(p);
+    return block;
+  }
+
+  // bytes must be the size that was passed to alloc().
+  void free_block(void* ptr, size_t bytes) {
+    if (ptr == NULL) {
+      return;
+    }
+    if (bytes > NABBIT_SLAB_MAX_SIZE) {
+      free(ptr);
+      return;
+    }
+
+    int c = size_class(bytes);
+    int p = acquire_slot();
+    SlabWorkerState* w = &workers[p];
+    NabbitSlabFreeBlock* block = (NabbitSlabFreeBlock*)ptr;
+    block->next = w->free_lists[c];
+    w->free_lists[c] = block;
+    release_slot(p);
+  }
+
+  // Returns the allocator which owns a block of the given size.
+  // Only meaningful for blocks of at most NABBIT_SLAB_MAX_SIZE bytes.
+  static inline NabbitSlabAllocator* owner_of(void* ptr) {
+    NabbitSlabChunk* chunk = (NabbitSlabChunk*)((size_t)ptr & ~((size_t)NABBIT_SLAB_CHUNK_SIZE - 1));
+    return chunk->owner;
+  }
+
+  // Frees every chunk, on every worker.  Only safe when no block
+  // from this allocator is still in use.
+  void release_all() {
+    for (int p = 0; p <= P; p++) {
+      NabbitSlabChunk* chunk = workers[p].chunks;
+      while (chunk != NULL) {
+	NabbitSlabChunk* next = chunk->next;
+	free(chunk);
+	chunk = next;
+      }
+      reset_slot(p);
+    }
+  }
+
+  // The allocator for objects which do not belong to a task graph.
+  // Created the first time it is needed, with one slot per Cilk
+  // worker, and never released.
+  static NabbitSlabAllocator* instance() {
+    static NabbitSlabAllocator* volatile the_allocator = NULL;
+    if (the_allocator == NULL) {
+      NabbitSlabAllocator* a = new NabbitSlabAllocator(__cilkrts_get_nworkers());
+      if (!__sync_bool_compare_and_swap(&the_allocator,
+					(NabbitSlabAllocator*)NULL,
+					a)) {
+	delete a;
+      }
+    }
+    return the_allocator;
+  }
+};
+
+
+#ifdef NABBIT_DISABLE_SLAB_ALLOCATOR
+
+inline void* nabbit_slab_alloc(size_t bytes,
+			       NabbitSlabAllocator* pool = NULL) {
+  return malloc(bytes);
+}
+
+inline void nabbit_slab_free(void* ptr, size_t bytes) {
+  free(ptr);
+}
+
+#else
+
+// Allocates from pool, or from the default allocator if pool is
+// NULL.
+inline void* nabbit_slab_alloc(size_t bytes,
+			       NabbitSlabAllocator* pool = NULL) {
+  if (pool == NULL) {
+    pool = NabbitSlabAllocator::instance();
+  }
+  return pool->alloc(bytes);
+}
+
+// Returns the block to whichever allocator it came from.
+inline void nabbit_slab_free(void* ptr, size_t bytes) {
+  if (ptr == NULL) {
+    return;
+  }
+  if (bytes > NABBIT_SLAB_MAX_SIZE) {
+    free(ptr);
+    return;
+  }
+  NabbitSlabAllocator::owner_of(ptr)->free_block(ptr, bytes);
+}
+
+#endif
+
+
+// Put this in a class declaration to allocate its objects from the
+// slabs.  "new T" uses the default allocator, and "new (pool) T"
+// uses pool.  Classes with subclasses should also have a virtual
+// destructor, so that delete passes the size of the actual object.
+#define NABBIT_SLAB_ALLOCATED						\
+  static void* operator new(size_t bytes) {				\
+    return nabbit_slab_alloc(bytes);					\
+  }									\
+  static void* operator new(size_t bytes, NabbitSlabAllocator* pool) { \
+    return nabbit_slab_alloc(bytes, pool);				\
+  }									\
+  static void operator delete(void* ptr, size_t bytes) {		\
+    nabbit_slab_free(ptr, bytes);					\
+  }
+
+
+#endif
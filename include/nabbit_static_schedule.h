@@ -0,0 +1,389 @@
+// Code for the Nabbit task graph library
+//
+// Copyright (c) 2010 Jim Sukha
+//
+//
+/*
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use, copy,
+ * modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+
+#ifndef _NABBIT_STATIC_SCHEDULE_H_
+#define _NABBIT_STATIC_SCHEDULE_H_
+
+#include <assert.h>
+#include <stdio.h>
+#include <algorithm>
+#include <map>
+#include <vector>
+#include <dag_status.h>
+#include <nabbit_timers.h>
+#include <static_nabbit_node.h>
+
+
+/**********************************************
+ * Precomputed schedules for static DAGs.
+ *
+ *  A static DAG which is evaluated many times, with about the same
+ *  cost per node each time, does not need work stealing: we can
+ *  decide once which worker runs each node, and in what order.
+ *
+ *  NabbitStaticSchedule collects the DAG reachable from a source
+ *  node, and assigns every node to one of P lanes with a list
+ *  scheduler in the style of HEFT:
+ *
+ *   1. The rank of a node is its cost plus the largest rank of its
+ *      successors, i.e., the length of the longest path from the
+ *      node to a sink.
+ *   2. Nodes are taken in decreasing order of rank, which puts
+ *      predecessors first, and each goes to the lane where it can
+ *      finish earliest.  (All lanes run at the same speed, and we do
+ *      not model communication.)
+ *
+ *  Costs start out as 1 per node.  execute() measures the cycles
+ *  each Compute() takes, so a program can run the DAG once, call
+ *  use_measured_costs(), and replay the improved schedule after that.
+ *
+ *  execute() spawns one strand per lane.  A lane runs its nodes in
+ *  order, and waits for a node's predecessors only by watching that
+ *  node's own counter, which each predecessor decrements when it
+ *  finishes: no deques, and no spawns per node.
+ *
+ *  If a node is still not ready after NABBIT_SCHEDULE_PATIENCE
+ *  checks (e.g., because another lane is running late, or two lanes
+ *  ended up on one worker), its lane gives the node up and moves on
+ *  to its next node.  A node which has been given up runs the way
+ *  compute_and_notify() runs nodes: the predecessor which makes it
+ *  ready spawns it, and work stealing balances it from there.  Every
+ *  node is claimed once, with a CAS, so it runs exactly once.
+ *
+ *  execute() does not touch the nodes' join counters, so the DAG does
+ *  not need to be rebuilt between runs, and it can still be run with
+ *  source_compute() afterwards.  Nodes which fold their predecessors
+ *  (e.g., StaticReductionNode) see every fold before Compute(), as
+ *  usual.  The DAG must not change while the schedule is in use.
+ */
+
+#ifndef NABBIT_SCHEDULE_PATIENCE
+#define NABBIT_SCHEDULE_PATIENCE 1000
+#endif
+
+// Tells the core we are spinning, so a sibling hyperthread can run.
+#if defined(__i386__) || defined(__x86_64__)
+#define NABBIT_SCHEDULE_PAUSE() __builtin_ia32_pause()
+#else
+#define NABBIT_SCHEDULE_PAUSE() __sync_synchronize()
+#endif
+
+
+class NabbitStaticSchedule {
+
+ private:
+  int P;
+  // The nodes, in topological order.
+  std::vector<StaticNabbitNode*> nodes;
+  std::vector<std::vector<int> > preds;
+  std::vector<std::vector<int> > succs;
+
+  std::vector<double> cost;
+  std::vector<double> measured;
+  std::vector<int> lane_of;
+  std::vector<std::vector<int> > lanes;
+  double makespan;
+
+  // State for one call to execute().
+  volatile int* remaining;
+  volatile int* claimed;
+  volatile int* finished;
+  // Set once the lane of a node has given up waiting for it.
+  volatile int* given_up;
+  volatile int num_off_schedule;
+
+  inline bool is_ready(int v) {
+    return __atomic_load_n(&this->remaining[v], __ATOMIC_ACQUIRE) == 0;
+  }
+
+  inline bool claim(int v) {
+    return (this->claimed[v] == 0) &&
+      __sync_bool_compare_and_swap(&this->claimed[v], 0, 1);
+  }
+
+  void collect(StaticNabbitNode* source) {
+    std::map<StaticNabbitNode*, int> index;
+    std::vector<StaticNabbitNode*> found;
+    index[source] = 0;
+    found.push_back(source);
+    for (size_t i = 0; i < found.size(); i++) {
+      StaticNabbitNode* n = found[i];
+      for (int j = 0; j < n->successors->size_estimate(); j++) {
+	StaticNabbitNode* s = n->successors->get(j);
+	if (index.find(s) == index.end()) {
+	  index[s] = (int)found.size();
+	  found.push_back(s);
+	}
+      }
+    }
+
+    // Put the nodes in topological order.
+    int n = (int)found.size();
+    std::vector<int> in_degree(n, 0);
+    for (int i = 0; i < n; i++) {
+      in_degree[i] = found[i]->predecessors->size_estimate();
+    }
+    std::vector<int> order;
+    order.push_back(0);
+    assert(in_degree[0] == 0);
+    for (size_t k = 0; k < order.size(); k++) {
+      StaticNabbitNode* v = found[order[k]];
+      for (int j = 0; j < v->successors->size_estimate(); j++) {
+	int s = index[v->successors->get(j)];
+	if (--in_degree[s] == 0) {
+	  order.push_back(s);
+	}
+      }
+    }
+    // Every predecessor of a node must be reachable from the source.
+    assert((int)order.size() == n);
+
+    std::vector<int> position(n);
+    for (int k = 0; k < n; k++) {
+      position[order[k]] = k;
+      this->nodes.push_back(found[order[k]]);
+    }
+    this->preds.resize(n);
+    this->succs.resize(n);
+    for (int k = 0; k < n; k++) {
+      StaticNabbitNode* v = this->nodes[k];
+      for (int j = 0; j < v->predecessors->size_estimate(); j++) {
+	this->preds[k].push_back(position[index[v->predecessors->get(j)]]);
+      }
+      for (int j = 0; j < v->successors->size_estimate(); j++) {
+	this->succs[k].push_back(position[index[v->successors->get(j)]]);
+      }
+    }
+  }
+
+  struct RankOrder {
+    const std::vector<double>* rank;
+    bool operator()(int a, int b) const {
+      if ((*rank)[a] != (*rank)[b]) {
+	return (*rank)[a] > (*rank)[b];
+      }
+      return a < b;
+    }
+  };
+
+  // Runs node v, which is ready and claimed by us.  Spawns the
+  // successors it makes ready which their lanes have given up.
+  void run_node(int v) {
+    StaticNabbitNode* n = this->nodes[v];
+    rTimeStruct start, end;
+    NabbitTimers::cycleCounter(&start);
+    n->run_compute();
+    NabbitTimers::cycleCounter(&end);
+    this->measured[v] = (double)(end - start);
+
+    for (size_t j = 0; j < this->succs[v].size(); j++) {
+      int s = this->succs[v][j];
+      StaticNabbitNode* sn = this->nodes[s];
+      if (sn->folds_predecessors) {
+	sn->FoldPredecessor(n);
+      }
+      // Pairs with the store to given_up in run_lane(): either we
+      // see that the lane gave s up, or the lane sees s is ready.
+      if ((__atomic_sub_fetch(&this->remaining[s], 1, __ATOMIC_SEQ_CST) == 0) &&
+	  __atomic_load_n(&this->given_up[s], __ATOMIC_SEQ_CST) &&
+	  this->claim(s)) {
+	__sync_add_and_fetch(&this->num_off_schedule, 1);
+	cilk_spawn this->run_node(s);
+      }
+    }
+    __atomic_store_n(&this->finished[v], 1, __ATOMIC_RELEASE);
+    cilk_sync;
+  }
+
+  void run_lane(int p) {
+    for (size_t k = 0; k < this->lanes[p].size(); k++) {
+      int v = this->lanes[p][k];
+      for (int wait = 0; (wait < NABBIT_SCHEDULE_PATIENCE) && !this->is_ready(v); wait++) {
+	NABBIT_SCHEDULE_PAUSE();
+      }
+      if (!this->is_ready(v)) {
+	// Leave v to the predecessor which makes it ready, unless
+	// that has just happened.
+	__atomic_store_n(&this->given_up[v], 1, __ATOMIC_SEQ_CST);
+	if (__atomic_load_n(&this->remaining[v], __ATOMIC_SEQ_CST) != 0) {
+	  continue;
+	}
+      }
+      if (this->claim(v)) {
+	this->run_node(v);
+      }
+    }
+  }
+
+ public:
+  // Collects the DAG reachable from source, and schedules it on P
+  // lanes with unit costs.
+  NabbitStaticSchedule(StaticNabbitNode* source, int P_)
+    : P(P_), makespan(0),
+      remaining(NULL), claimed(NULL), finished(NULL), given_up(NULL),
+      num_off_schedule(0) {
+    assert(P > 0);
+    this->collect(source);
+    this->cost.assign(this->nodes.size(), 1.0);
+    this->measured.assign(this->nodes.size(), 0.0);
+    this->build();
+  }
+
+  int get_num_nodes() const {
+    return (int)this->nodes.size();
+  }
+  int get_num_lanes() const {
+    return this->P;
+  }
+
+  // Node k in topological order.
+  StaticNabbitNode* get_node(int k) const {
+    return this->nodes[k];
+  }
+
+  void set_cost(int k, double c) {
+    this->cost[k] = (c > 0) ? c : 0;
+  }
+  double get_cost(int k) const {
+    return this->cost[k];
+  }
+
+  // Uses the cycle counts from the last execute() as the costs, and
+  // rebuilds the schedule.
+  void use_measured_costs() {
+    for (size_t k = 0; k < this->nodes.size(); k++) {
+      this->set_cost(k, this->measured[k]);
+    }
+    this->build();
+  }
+
+  // Assigns the nodes to lanes, using the current costs.
+  void build() {
+    int n = (int)this->nodes.size();
+    std::vector<double> rank(n, 0.0);
+    for (int k = n - 1; k >= 0; k--) {
+      double max_succ = 0;
+      for (size_t j = 0; j < this->succs[k].size(); j++) {
+	max_succ = std::max(max_succ, rank[this->succs[k][j]]);
+      }
+      rank[k] = this->cost[k] + max_succ;
+    }
+
+    std::vector<int> order(n);
+    for (int k = 0; k < n; k++) {
+      order[k] = k;
+    }
+    RankOrder by_rank;
+    by_rank.rank = &rank;
+    std::sort(order.begin(), order.end(), by_rank);
+
+    std::vector<double> finish(n, 0.0);
+    std::vector<double> lane_free(P, 0.0);
+    this->lanes.assign(P, std::vector<int>());
+    this->lane_of.assign(n, -1);
+    this->makespan = 0;
+    for (int i = 0; i < n; i++) {
+      int v = order[i];
+      double ready_time = 0;
+      for (size_t j = 0; j < this->preds[v].size(); j++) {
+	assert(this->lane_of[this->preds[v][j]] >= 0);
+	ready_time = std::max(ready_time, finish[this->preds[v][j]]);
+      }
+      int best = 0;
+      double best_finish = 0;
+      for (int p = 0; p < P; p++) {
+	double f = std::max(lane_free[p], ready_time) + this->cost[v];
+	if ((p == 0) || (f < best_finish)) {
+	  best = p;
+	  best_finish = f;
+	}
+      }
+      this->lanes[best].push_back(v);
+      this->lane_of[v] = best;
+      lane_free[best] = best_finish;
+      finish[v] = best_finish;
+      this->makespan = std::max(this->makespan, best_finish);
+    }
+  }
+
+  // The lane node k is assigned to.
+  int get_lane(int k) const {
+    return this->lane_of[k];
+  }
+
+  // The nodes of lane p, in the order the lane runs them.
+  const std::vector<int>& get_lane_nodes(int p) const {
+    return this->lanes[p];
+  }
+
+  // The finishing time of the schedule, in the units of the costs.
+  double get_makespan() const {
+    return this->makespan;
+  }
+
+  // How many nodes the last execute() ran outside of their lane's
+  // order, because their lane gave them up.
+  int get_num_off_schedule() const {
+    return this->num_off_schedule;
+  }
+
+  // Evaluates the DAG once, following the schedule.
+  void execute() {
+    int n = (int)this->nodes.size();
+    this->remaining = new int[n];
+    this->claimed = new int[n];
+    this->finished = new int[n];
+    this->given_up = new int[n];
+    for (int k = 0; k < n; k++) {
+      this->remaining[k] = (int)this->preds[k].size();
+      this->claimed[k] = 0;
+      this->finished[k] = 0;
+      this->given_up[k] = 0;
+    }
+    this->num_off_schedule = 0;
+
+    for (int p = 0; p < P; p++) {
+      cilk_spawn this->run_lane(p);
+    }
+    cilk_sync;
+
+    for (int k = 0; k < n; k++) {
+      assert(this->finished[k]);
+    }
+    delete[] this->remaining;
+    delete[] this->claimed;
+    delete[] this->finished;
+    delete[] this->given_up;
+    this->remaining = NULL;
+    this->claimed = NULL;
+    this->finished = NULL;
+    this->given_up = NULL;
+  }
+};
+
+#endif
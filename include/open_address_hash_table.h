@@ -0,0 +1,265 @@
+// Code for the Nabbit task graph library
+//
+// Copyright (c) 2010 Jim Sukha
+//
+//
+/*
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use, copy,
+ * modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+
+#ifndef __OPEN_ADDRESS_HASH_TABLE_H
+#define __OPEN_ADDRESS_HASH_TABLE_H
+
+
+/**
+ * A concurrent, insert-only hash table using open addressing.
+ *
+ * This table supports the same search / insert_if_absent interface
+ * as ConcurrentHashTable, and can be used in its place.  Instead of
+ * chasing a bucket pointer and a linked list of heap nodes, the
+ * table is a single array of cache-line sized buckets, each holding
+ * OA_BUCKET_SLOTS key-value pairs.  We find a key with linear probing
+ * over buckets, so a lookup usually touches only one or two cache
+ * lines.
+ *
+ * A key is claimed by a CAS on its slot, and the value is written
+ * immediately afterwards.  A search which finds the key before the
+ * value has been published returns OP_FAILED, and the caller should
+ * retry (just as it would on contention in ConcurrentHashTable).
+ *
+ * Restrictions:
+ *   1. The table does not resize.  The constructor takes the
+ *      maximum number of elements we expect to store, and allocates
+ *      a power of two number of slots at least twice that large.
+ *   2. Values must not be NULL, and keys must not be OA_EMPTY_KEY.
+ *   3. There is no delete.
+ */
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "concurrent_linked_list.h"
+
+
+#define OA_EMPTY_KEY ((long long)(0x8000000000000000ULL))
+#define OA_BUCKET_SLOTS 4
+#define OA_CACHE_LINE_SIZE 64
+
+
+struct OpenAddressBucket {
+  volatile long long keys[OA_BUCKET_SLOTS];
+  void* volatile vals[OA_BUCKET_SLOTS];
+};
+
+
+class OpenAddressHashTable {
+
+ private:
+  OpenAddressBucket* buckets;
+  long long num_buckets;
+  long long bucket_mask;
+
+
+  // Looks for the slot for key k, starting from the bucket k hashes
+  // to.  Returns the bucket and sets *slot, if we find either the key
+  // or the first empty slot.  Returns NULL if the table is full.
+  inline OpenAddressBucket* find_slot(long long k,
+				      int* slot) {
+    long long idx = hashcode(k);
+    for (long long i = 0; i < num_buckets; i++) {
+      OpenAddressBucket* b = &buckets[(idx + i) & bucket_mask];
+      for (int j = 0; j < OA_BUCKET_SLOTS; j++) {
+	long long current_key = b->keys[j];
+	if ((current_key == k) || (current_key == OA_EMPTY_KEY)) {
+	  *slot = j;
+	  return b;
+	}
+      }
+    }
+    return NULL;
+  }
+
+  // Reads the value for a slot whose key is already set.
+  inline void* read_value(OpenAddressBucket* b,
+			  int j,
+			  LOpStatus* code) {
+    void* v = b->vals[j];
+    *code = (v != NULL) ? OP_FOUND : OP_FAILED;
+    return v;
+  }
+
+
+ public:
+  OpenAddressHashTable(long long max_num_elements) {
+    long long min_slots = 2 * max_num_elements;
+    assert(max_num_elements > 0);
+
+    num_buckets = 1;
+    while (num_buckets * OA_BUCKET_SLOTS < min_slots) {
+      num_buckets *= 2;
+    }
+    bucket_mask = num_buckets - 1;
+
+    void* mem = NULL;
+    int err = posix_memalign(&mem,
+			     OA_CACHE_LINE_SIZE,
+			     num_buckets * sizeof(OpenAddressBucket));
+    assert(err == 0);
+    buckets = (OpenAddressBucket*)mem;
+
+    for (long long i = 0; i < num_buckets; i++) {
+      for (int j = 0; j < OA_BUCKET_SLOTS; j++) {
+	buckets[i].keys[j] = OA_EMPTY_KEY;
+	buckets[i].vals[j] = NULL;
+      }
+    }
+  }
+
+  ~OpenAddressHashTable() {
+    free(buckets);
+  }
+
+
+  void print_table() {
+    int num_nonempty_buckets = 0;
+    printf("OpenAddressHashTable %p: num_buckets = %lld\n",
+	   this, num_buckets);
+    for (long long i = 0; i < num_buckets; i++) {
+      if (buckets[i].keys[0] != OA_EMPTY_KEY) {
+	printf("--- Bucket %lld: ", i);
+	for (int j = 0; j < OA_BUCKET_SLOTS; j++) {
+	  if (buckets[i].keys[j] != OA_EMPTY_KEY) {
+	    printf("(%lld, %p) ",
+		   buckets[i].keys[j],
+		   buckets[i].vals[j]);
+	  }
+	}
+	printf("\n");
+	num_nonempty_buckets++;
+      }
+    }
+    printf("Nonempty_bucket_count = %d\n",
+	   num_nonempty_buckets);
+  }
+
+  // The finalizer from MurmurHash3, so that consecutive keys are
+  // spread over the whole table.
+  inline long long hashcode(long long key) {
+    unsigned long long h = (unsigned long long)key;
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+    h *= 0xc4ceb9fe1a85ec53ULL;
+    h ^= h >> 33;
+    return (long long)(h & bucket_mask);
+  }
+
+  void* search(long long k,
+	       LOpStatus *code) {
+    int j;
+    OpenAddressBucket* b = find_slot(k, &j);
+    if ((b == NULL) || (b->keys[j] != k)) {
+      *code = OP_NOT_FOUND;
+      return NULL;
+    }
+    return read_value(b, j, code);
+  }
+
+
+  /**
+   * Attempts to atomically insert (k, val) into the table.
+   * The return codes match ConcurrentHashTable:
+   *
+   * 1. OP_FOUND: A value for k is already in the table.  Returns
+   *              that value.
+   * 2. OP_INSERTED: We inserted (k, val).  Returns val.
+   * 3. OP_FAILED: Another thread has claimed k, but has not yet
+   *               written its value.  Returns NULL.
+   * 4. OP_ERROR: The table is full.  Returns NULL.
+   */
+  void* insert_if_absent(long long k,
+			 void* val,
+			 LOpStatus *code) {
+    assert(val != NULL);
+    assert(k != OA_EMPTY_KEY);
+
+    while (true) {
+      int j;
+      OpenAddressBucket* b = find_slot(k, &j);
+      if (b == NULL) {
+	*code = OP_ERROR;
+	return NULL;
+      }
+
+      if (b->keys[j] == k) {
+	return read_value(b, j, code);
+      }
+
+      // Try to claim the empty slot.  If we lose, someone else
+      // filled this slot (possibly with k), so probe again.
+      if (__sync_bool_compare_and_swap(&b->keys[j],
+				       OA_EMPTY_KEY,
+				       k)) {
+	b->vals[j] = val;
+	__sync_synchronize();
+	*code = OP_INSERTED;
+	return val;
+      }
+    }
+  }
+
+
+  // Return a list of keys of elements in the hash table.
+  long long* get_keys(long long* final_size) {
+    long long size_to_return = 0;
+    long long* a = NULL;
+
+    for (long long i = 0; i < num_buckets; i++) {
+      for (int j = 0; j < OA_BUCKET_SLOTS; j++) {
+	if (buckets[i].keys[j] != OA_EMPTY_KEY) {
+	  size_to_return++;
+	}
+      }
+    }
+
+    long long current = 0;
+    if (size_to_return > 0) {
+      a = new long long[size_to_return];
+      assert(a != NULL);
+      for (long long i = 0; i < num_buckets; i++) {
+	for (int j = 0; j < OA_BUCKET_SLOTS; j++) {
+	  long long k = buckets[i].keys[j];
+	  if ((k != OA_EMPTY_KEY) && (current < size_to_return)) {
+	    a[current++] = k;
+	  }
+	}
+      }
+    }
+
+    *final_size = current;
+    return a;
+  }
+};
+
+
+#endif
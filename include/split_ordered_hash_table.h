@@ -0,0 +1,421 @@
+// Code for the Nabbit task graph library
+//
+// Copyright (c) 2010 Jim Sukha
+//
+//
+/*
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use, copy,
+ * modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+
+#ifndef __SPLIT_ORDERED_HASH_TABLE_H
+#define __SPLIT_ORDERED_HASH_TABLE_H
+
+
+/**
+ * A concurrent, insert-only hash table which grows online, based on
+ * the split-ordered lists of Shalev and Shavit.
+ *
+ * All elements live in one lock-free linked list, sorted by the
+ * bit-reversed hash of their key (their "split-order" key).  With
+ * this ordering, the elements of bucket b (for a table of size 2^i)
+ * form a contiguous sublist, which starts at a dummy node for
+ * b.  Doubling the table never moves any elements: bucket b splits
+ * into buckets b and b + 2^i simply by inserting a new dummy node
+ * into the middle of the sublist for b.
+ *
+ * The bucket array is a directory of lazily allocated segments, so
+ * growing the table is a single CAS on num_buckets.  Dummy nodes for
+ * new buckets are created on demand by the first operation which
+ * touches them.  Neither searches nor inserts ever block, or have
+ * to wait for a resize.
+ *
+ * This table supports the same search / insert_if_absent interface
+ * as ConcurrentHashTable, and can be used in its place.  The
+ * constructor argument is only the initial number of buckets.
+ */
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "concurrent_linked_list.h"
+
+
+// Buckets [0, SO_FIRST_SEGMENT_SIZE) are in segment 0.  Segment
+// s > 0 holds the SO_FIRST_SEGMENT_SIZE * 2^(s-1) buckets after that.
+#define SO_LOG_FIRST_SEGMENT_SIZE 6
+#define SO_FIRST_SEGMENT_SIZE (1LL << SO_LOG_FIRST_SEGMENT_SIZE)
+#define SO_MAX_SEGMENTS 58
+
+// We double the number of buckets when the average number of
+// elements per bucket exceeds this value.
+#define SO_MAX_LOAD 2
+
+
+struct SplitOrderedNode {
+  unsigned long long so_key;
+  long long key;
+  void* value;
+  SplitOrderedNode* volatile next;
+
+  SplitOrderedNode(unsigned long long so_key_,
+		   long long key_,
+		   void* value_)
+    : so_key(so_key_), key(key_), value(value_), next(NULL) { }
+
+  NABBIT_SLAB_ALLOCATED
+
+  // Dummy nodes have even split-order keys.
+  inline bool is_dummy() {
+    return ((so_key & 1) == 0);
+  }
+};
+
+
+class SplitOrderedHashTable {
+
+ private:
+  SplitOrderedNode* volatile* volatile segments[SO_MAX_SEGMENTS];
+  volatile long long num_buckets;
+  volatile long long num_elements;
+
+
+  static inline unsigned long long reverse_bits(unsigned long long x) {
+    x = ((x >> 1) & 0x5555555555555555ULL) | ((x & 0x5555555555555555ULL) << 1);
+    x = ((x >> 2) & 0x3333333333333333ULL) | ((x & 0x3333333333333333ULL) << 2);
+    x = ((x >> 4) & 0x0F0F0F0F0F0F0F0FULL) | ((x & 0x0F0F0F0F0F0F0F0FULL) << 4);
+    x = ((x >> 8) & 0x00FF00FF00FF00FFULL) | ((x & 0x00FF00FF00FF00FFULL) << 8);
+    x = ((x >> 16) & 0x0000FFFF0000FFFFULL) | ((x & 0x0000FFFF0000FFFFULL) << 16);
+    return (x >> 32) | (x << 32);
+  }
+
+  // Regular keys get the top bit set before reversing, so their
+  // split-order keys are odd and sort after the dummy for their
+  // bucket.
+  static inline unsigned long long regular_so_key(unsigned long long h) {
+    return reverse_bits(h | 0x8000000000000000ULL);
+  }
+
+  static inline unsigned long long dummy_so_key(long long bucket) {
+    return reverse_bits((unsigned long long)bucket);
+  }
+
+  static inline int highest_bit(long long x) {
+    return 63 - __builtin_clzll((unsigned long long)x);
+  }
+
+  // Maps a bucket index to its segment and the offset in that segment.
+  static inline void bucket_location(long long bucket,
+				     int* seg,
+				     long long* offset) {
+    if (bucket < SO_FIRST_SEGMENT_SIZE) {
+      *seg = 0;
+      *offset = bucket;
+    }
+    else {
+      int hb = highest_bit(bucket);
+      *seg = hb - SO_LOG_FIRST_SEGMENT_SIZE + 1;
+      *offset = bucket - (1LL << hb);
+    }
+  }
+
+  static inline long long segment_size(int seg) {
+    if (seg == 0) {
+      return SO_FIRST_SEGMENT_SIZE;
+    }
+    return SO_FIRST_SEGMENT_SIZE << (seg - 1);
+  }
+
+  // Returns the slot in the directory for bucket, allocating its
+  // segment if necessary.
+  SplitOrderedNode* volatile* bucket_slot(long long bucket) {
+    int seg;
+    long long offset;
+    bucket_location(bucket, &seg, &offset);
+    assert(seg < SO_MAX_SEGMENTS);
+
+    if (segments[seg] == NULL) {
+      SplitOrderedNode* volatile* new_seg;
+      new_seg = (SplitOrderedNode* volatile*)calloc(segment_size(seg),
+						    sizeof(SplitOrderedNode*));
+      assert(new_seg != NULL);
+      if (!__sync_bool_compare_and_swap(&segments[seg],
+					(SplitOrderedNode* volatile*)NULL,
+					new_seg)) {
+	// Someone else installed the segment first.
+	free((void*)new_seg);
+      }
+    }
+    return &segments[seg][offset];
+  }
+
+
+  // Walks the list starting from start, looking for the node with
+  // split-order key so_key and key k.  Returns that node if it
+  // exists.  Otherwise, returns NULL, and sets *prev and *cur so that
+  // a new node belongs between them.
+  static SplitOrderedNode* list_find(SplitOrderedNode* start,
+				     unsigned long long so_key,
+				     long long k,
+				     SplitOrderedNode** prev,
+				     SplitOrderedNode** cur) {
+    SplitOrderedNode* p = start;
+    SplitOrderedNode* c = p->next;
+    while (c != NULL) {
+      if (c->so_key > so_key) {
+	break;
+      }
+      if ((c->so_key == so_key) && (c->key == k)) {
+	return c;
+      }
+      p = c;
+      c = c->next;
+    }
+    *prev = p;
+    *cur = c;
+    return NULL;
+  }
+
+  // Links new_node into the list after start, unless a node with
+  // the same keys is already there.  Returns the node which ends up
+  // in the list, and sets *inserted if that node is new_node.
+  //
+  // Nodes are never removed, so after a failed CAS we can resume the
+  // search from prev instead of from start.
+  static SplitOrderedNode* list_insert(SplitOrderedNode* start,
+				       SplitOrderedNode* new_node,
+				       bool* inserted) {
+    SplitOrderedNode* prev = start;
+    *inserted = false;
+    while (true) {
+      SplitOrderedNode* cur;
+      SplitOrderedNode* found = list_find(prev,
+					  new_node->so_key,
+					  new_node->key,
+					  &prev,
+					  &cur);
+      if (found) {
+	return found;
+      }
+      new_node->next = cur;
+      if (__sync_bool_compare_and_swap(&prev->next,
+				       cur,
+				       new_node)) {
+	*inserted = true;
+	return new_node;
+      }
+    }
+  }
+
+  // Returns the dummy node for bucket, creating it (and the dummy
+  // nodes of its parent buckets) if needed.
+  SplitOrderedNode* get_bucket_head(long long bucket) {
+    SplitOrderedNode* volatile* slot = bucket_slot(bucket);
+    SplitOrderedNode* head = *slot;
+    if (head != NULL) {
+      return head;
+    }
+
+    // The parent of bucket is bucket with its highest bit cleared.
+    assert(bucket > 0);
+    long long parent = bucket & ~(1LL << highest_bit(bucket));
+    SplitOrderedNode* parent_head = get_bucket_head(parent);
+
+    bool inserted;
+    SplitOrderedNode* dummy = new SplitOrderedNode(dummy_so_key(bucket),
+						   bucket,
+						   NULL);
+    head = list_insert(parent_head, dummy, &inserted);
+    if (!inserted) {
+      delete dummy;
+    }
+    *slot = head;
+    return head;
+  }
+
+  // Doubles the number of buckets if the table is too full.  If
+  // several threads try at once, only one CAS succeeds.
+  inline void maybe_grow(long long current_elements) {
+    long long size = num_buckets;
+    if (current_elements > SO_MAX_LOAD * size) {
+      long long max_buckets = SO_FIRST_SEGMENT_SIZE << (SO_MAX_SEGMENTS - 2);
+      if (2 * size <= max_buckets) {
+	__sync_bool_compare_and_swap(&num_buckets,
+				     size,
+				     2 * size);
+      }
+    }
+  }
+
+
+ public:
+  SplitOrderedHashTable(int initial_num_buckets) {
+    assert(initial_num_buckets > 0);
+    for (int i = 0; i < SO_MAX_SEGMENTS; i++) {
+      segments[i] = NULL;
+    }
+
+    num_buckets = 1;
+    while (num_buckets < initial_num_buckets) {
+      num_buckets *= 2;
+    }
+    num_elements = 0;
+
+    // The dummy node for bucket 0 is the head of the whole list.
+    *bucket_slot(0) = new SplitOrderedNode(dummy_so_key(0), 0, NULL);
+  }
+
+  ~SplitOrderedHashTable() {
+    SplitOrderedNode* c = *bucket_slot(0);
+    while (c != NULL) {
+      SplitOrderedNode* next = c->next;
+      delete c;
+      c = next;
+    }
+
+    for (int i = 0; i < SO_MAX_SEGMENTS; i++) {
+      if (segments[i] != NULL) {
+	free((void*)segments[i]);
+      }
+    }
+  }
+
+
+  // Same hash as OpenAddressHashTable (the MurmurHash3 finalizer).
+  // The bucket for a key is the low bits of its hash.
+  static inline unsigned long long hashcode(long long key) {
+    unsigned long long h = (unsigned long long)key;
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+    h *= 0xc4ceb9fe1a85ec53ULL;
+    h ^= h >> 33;
+    return h;
+  }
+
+  long long get_num_buckets() {
+    return num_buckets;
+  }
+
+  long long get_size_estimate() {
+    return num_elements;
+  }
+
+
+  void print_table() {
+    printf("SplitOrderedHashTable %p: num_buckets = %lld, num_elements = %lld\n",
+	   this, num_buckets, num_elements);
+    SplitOrderedNode* c = *bucket_slot(0);
+    while (c != NULL) {
+      if (c->is_dummy()) {
+	printf("\n--- Bucket %lld: ", c->key);
+      }
+      else {
+	printf("(%lld, %p) ", c->key, c->value);
+      }
+      c = c->next;
+    }
+    printf("\n");
+  }
+
+  // Operations on this table never fail because of contention, so
+  // *code is always OP_FOUND or OP_NOT_FOUND.
+  void* search(long long k,
+	       LOpStatus *code) {
+    unsigned long long h = hashcode(k);
+    long long bucket = (long long)(h & (num_buckets - 1));
+    SplitOrderedNode* prev;
+    SplitOrderedNode* cur;
+    SplitOrderedNode* found = list_find(get_bucket_head(bucket),
+					regular_so_key(h),
+					k,
+					&prev,
+					&cur);
+    if (found) {
+      *code = OP_FOUND;
+      return found->value;
+    }
+    *code = OP_NOT_FOUND;
+    return NULL;
+  }
+
+
+  /**
+   * Attempts to atomically insert (k, val) into the table.
+   * The return codes match ConcurrentHashTable:
+   *
+   * 1. OP_FOUND: A value for k is already in the table.  Returns
+   *              that value.
+   * 2. OP_INSERTED: We inserted (k, val).  Returns val.
+   *
+   * This method never returns OP_FAILED.
+   */
+  void* insert_if_absent(long long k,
+			 void* val,
+			 LOpStatus *code) {
+    unsigned long long h = hashcode(k);
+    long long bucket = (long long)(h & (num_buckets - 1));
+    SplitOrderedNode* head = get_bucket_head(bucket);
+
+    bool inserted;
+    SplitOrderedNode* new_node = new SplitOrderedNode(regular_so_key(h),
+						      k,
+						      val);
+    SplitOrderedNode* result = list_insert(head, new_node, &inserted);
+    if (!inserted) {
+      delete new_node;
+      *code = OP_FOUND;
+      return result->value;
+    }
+
+    long long current_elements = __sync_add_and_fetch(&num_elements, 1);
+    maybe_grow(current_elements);
+    *code = OP_INSERTED;
+    return val;
+  }
+
+
+  // Return a list of keys of elements in the hash table.
+  long long* get_keys(long long* final_size) {
+    long long size_to_return = num_elements;
+    long long current = 0;
+    long long* a = NULL;
+
+    if (size_to_return > 0) {
+      a = new long long[size_to_return];
+      assert(a != NULL);
+      SplitOrderedNode* c = *bucket_slot(0);
+      while ((c != NULL) && (current < size_to_return)) {
+	if (!c->is_dummy()) {
+	  a[current++] = c->key;
+	}
+	c = c->next;
+      }
+    }
+
+    *final_size = current;
+    return a;
+  }
+};
+
+
+#endif
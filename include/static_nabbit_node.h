@@ -30,18 +30,33 @@
 
 #include <dag_status.h>
 #include <dynamic_array.h>
+#include <nabbit_combining_counter.h>
+#include <nabbit_elastic.h>
+#include <nabbit_inline_array.h>
+#include <nabbit_memory_budget.h>
+#include <nabbit_node_layout.h>
+#include <nabbit_placement.h>
+#include <nabbit_scratch_arena.h>
 
 // Debugging flag.
 //#define NABBIT_PRINT_DEBUG 1
 
 class StaticNabbitNode;
-typedef DynamicArray<StaticNabbitNode*> StaticNabbitNodeArray;
+class NabbitStaticSchedule;
+class NabbitLevelExecutor;
+typedef NabbitInlineArray<StaticNabbitNode*, NABBIT_INLINE_DEGREE> StaticNabbitNodeArray;
 
 
 class StaticNabbitNode {
+  // Replays precomputed schedules (see nabbit_static_schedule.h).
+  friend class NabbitStaticSchedule;
+  // Runs the DAG one level at a time (see nabbit_level_executor.h).
+  friend class NabbitLevelExecutor;
 
  public:
   long long key;
+  // Point at pred_storage and succ_storage once the node is
+  // initialized.
   StaticNabbitNodeArray* predecessors;
   StaticNabbitNodeArray* successors;
   //  StaticNabbitNodeArray* children;
@@ -59,15 +74,85 @@ class StaticNabbitNode {
   void add_dep(StaticNabbitNode* child);
   
   void add_child(StaticNabbitNode* child);
+
+  // Same as above, where this node reads input_bytes bytes of the
+  // output of dep_node (see nabbit_placement.h).
+  void add_dep(StaticNabbitNode* dep_node, long long input_bytes);
+  void add_child(StaticNabbitNode* dep_node, long long input_bytes);
+
+  // The size of the output of Compute(), for memory-aware execution
+  // (see nabbit_memory_budget.h).
+  void set_output_bytes(long long bytes);
+  long long get_output_bytes() const;
+
   void source_compute();
   
  protected:
   virtual void InitNode() = 0;
   virtual void Compute() = 0;
 
+  // Called when this node is enabled, shortly before Compute() runs.
+  // Override to prefetch the inputs of Compute().
+  virtual void PrefetchInputs() { }
+
+  // Temporary memory for the current call to Compute().  It is freed
+  // automatically when Compute() returns.  Only call this from the
+  // Compute() strand itself (see nabbit_scratch_arena.h).
+  void* scratch(size_t bytes);
+
+  // If folds_predecessors is set, FoldPredecessor(pred) is called as
+  // each predecessor finishes, on the worker which ran it, before the
+  // predecessor counts down our join counter.  Compute() then sees
+  // every fold (see nabbit_reduction_node.h).
+  bool folds_predecessors;
+  virtual void FoldPredecessor(StaticNabbitNode* pred) { }
+
+  // With NABBIT_MEMORY_AWARE, called once every successor has
+  // finished Compute().  Override to free the output.
+  virtual void ReleaseOutput() { }
+
  private:
-  volatile int join_counter; 
+  // Only set while Compute() is running.
+  NabbitScratchArena* scratch_arena;
+  StaticNabbitNodeArray pred_storage;
+  StaticNabbitNodeArray succ_storage;
+
+  // The predecessor with the heaviest edge into this node, if any
+  // edge has a weight.
+  StaticNabbitNode* heaviest_pred;
+  long long heaviest_input_bytes;
+  long long output_bytes;
+
+  // Only used once the node has more than NABBIT_COMBINING_THRESHOLD
+  // predecessors.  join_counter then counts the leaves of this
+  // counter instead of the predecessors (see
+  // nabbit_combining_counter.h).
+  NabbitCombiningCounter* combining;
+
+  // Scheduler state, which predecessors update while the DAG runs.
+  // Kept apart from the read-mostly fields (see nabbit_node_layout.h).
+  volatile int join_counter NABBIT_CACHE_ALIGNED;
+  // The worker which ran Compute(), or -1.
+  int producer_worker;
+  // The successors which have not finished Compute() yet.  Only
+  // used with NABBIT_MEMORY_AWARE.
+  volatile int pending_consumers;
+  // The predecessors NabbitLevelExecutor has placed on a level so
+  // far.  0 except while it computes levels.
+  volatile int level_arrivals;
+
+  void count_predecessor(StaticNabbitNode* dep_node);
+  void note_input_bytes(StaticNabbitNode* dep_node, long long input_bytes);
+  bool post_to_producer(NabbitMailCell** posts);
+  void use_combining_counter();
+  inline int decrement_join_counter(StaticNabbitNode* pred);
+  void release_inputs();
+  long long bytes_freed_by_compute();
+  static void order_by_bytes_freed(StaticNabbitNode** nodes, int n);
+
+  void run_compute();
   void compute_and_notify();
+  void notify_successors(int start, int end);
 
 };
 
@@ -75,22 +160,37 @@ class StaticNabbitNode {
 StaticNabbitNode::StaticNabbitNode(long long k) 
   :  key(k),
      predecessors(NULL),
-     successors(NULL) {
+     successors(NULL),
+     folds_predecessors(false),
+     scratch_arena(NULL),
+     heaviest_pred(NULL),
+     heaviest_input_bytes(0),
+     output_bytes(0),
+     combining(NULL),
+     producer_worker(-1),
+     pending_consumers(0),
+     level_arrivals(0) {
 }
 
 StaticNabbitNode::StaticNabbitNode(long long k, int num_predecessors) 
   :  key(k),
      predecessors(NULL),
-     successors(NULL) {
+     successors(NULL),
+     folds_predecessors(false),
+     scratch_arena(NULL),
+     heaviest_pred(NULL),
+     heaviest_input_bytes(0),
+     output_bytes(0),
+     combining(NULL),
+     producer_worker(-1),
+     pending_consumers(0),
+     level_arrivals(0) {
 }
 
      
 StaticNabbitNode::~StaticNabbitNode() {
-  if (this->predecessors) {
-    delete this->predecessors;
-  }
-  if (this->successors != NULL) {
-    delete this->successors;
+  if (this->combining) {
+    delete this->combining;
   }
 }
 
@@ -98,11 +198,25 @@ StaticNabbitNode::~StaticNabbitNode() {
 /***************************************************************/
 // Methods for constructing the dag statically. 
 
+// The first NABBIT_INLINE_DEGREE edges in each direction are stored
+// in the node itself, so default_degree is only a hint.
 void StaticNabbitNode::init_node(int default_degree) {
 
-  this->predecessors = new StaticNabbitNodeArray(default_degree);
-  this->successors = new StaticNabbitNodeArray(default_degree);
+  this->pred_storage.clear();
+  this->succ_storage.clear();
+  this->predecessors = &this->pred_storage;
+  this->successors = &this->succ_storage;
   this->join_counter = 0;
+  this->producer_worker = -1;
+  this->heaviest_pred = NULL;
+  this->heaviest_input_bytes = 0;
+  this->output_bytes = 0;
+  this->pending_consumers = 0;
+  this->level_arrivals = 0;
+  if (this->combining) {
+    delete this->combining;
+    this->combining = NULL;
+  }
   //  this->children = this->predecessors;
 
   // Call user-defined initialization.
@@ -121,16 +235,124 @@ void StaticNabbitNode::add_dep(StaticNabbitNode* dep_node) {
   // Add an edge from dep_node -> this.
   this->predecessors->add(dep_node);
   dep_node->successors->add(this);
-  __sync_add_and_fetch(&this->join_counter,
-		       1);
+  this->count_predecessor(dep_node);
 }
 
 void StaticNabbitNode::add_child(StaticNabbitNode* dep_node) {
   // Add an edge from dep_node -> this.
   this->predecessors->add(dep_node);
   dep_node->successors->add(this);
-  __sync_add_and_fetch(&this->join_counter,
-		       1);
+  this->count_predecessor(dep_node);
+}
+
+void StaticNabbitNode::add_dep(StaticNabbitNode* dep_node,
+			       long long input_bytes) {
+  this->add_dep(dep_node);
+  this->note_input_bytes(dep_node, input_bytes);
+}
+
+void StaticNabbitNode::add_child(StaticNabbitNode* dep_node,
+				 long long input_bytes) {
+  this->add_child(dep_node);
+  this->note_input_bytes(dep_node, input_bytes);
+}
+
+void StaticNabbitNode::set_output_bytes(long long bytes) {
+  this->output_bytes = (bytes > 0) ? bytes : 0;
+}
+
+long long StaticNabbitNode::get_output_bytes() const {
+  return this->output_bytes;
+}
+
+void StaticNabbitNode::note_input_bytes(StaticNabbitNode* dep_node,
+					long long input_bytes) {
+  if (input_bytes > this->heaviest_input_bytes) {
+    this->heaviest_pred = dep_node;
+    this->heaviest_input_bytes = input_bytes;
+  }
+}
+
+
+// Adds dep_node, which has just been added as a predecessor, to the
+// join counter.  A predecessor always arrives at the leaf picked by
+// its address, since it does not know its index in our list.
+void StaticNabbitNode::count_predecessor(StaticNabbitNode* dep_node) {
+  if (this->combining) {
+    int leaf = this->combining->leaf_for_pointer(dep_node);
+    if (this->combining->add_arrival(leaf)) {
+      __sync_add_and_fetch(&this->join_counter, 1);
+    }
+  }
+  else {
+    __sync_add_and_fetch(&this->join_counter,
+			 1);
+    if (this->predecessors->size_estimate() > NABBIT_COMBINING_THRESHOLD) {
+      this->use_combining_counter();
+    }
+  }
+}
+
+// Moves the predecessors we have so far onto a combining counter.
+// Nothing can arrive yet, since the DAG is still being built.
+void StaticNabbitNode::use_combining_counter() {
+  NabbitCombiningCounter* c = new NabbitCombiningCounter(NABBIT_COMBINING_LEAVES);
+  int num_leaves_used = 0;
+  for (int i = 0; i < this->predecessors->size_estimate(); i++) {
+    int leaf = c->leaf_for_pointer(this->predecessors->get(i));
+    if (c->add_arrival(leaf)) {
+      num_leaves_used++;
+    }
+  }
+  this->join_counter = num_leaves_used;
+  this->combining = c;
+}
+
+// Records the arrival of pred, and returns the new value of the join
+// counter.  If the arrival stops at a leaf of the combining counter,
+// returns 1 without touching the join counter, which is still
+// positive.
+int StaticNabbitNode::decrement_join_counter(StaticNabbitNode* pred) {
+  if (this->folds_predecessors) {
+    this->FoldPredecessor(pred);
+  }
+  if (this->combining &&
+      !this->combining->arrive(this->combining->leaf_for_pointer(pred))) {
+    return 1;
+  }
+  if (this->join_counter <= 0) {
+    printf("ERROR: pred key = %llu, this = %p (key = %llu), join coutner = %d\n",
+	   pred->key,
+	   this, this->key,
+	   this->join_counter);
+  }
+  assert(this->join_counter > 0);
+  return __sync_add_and_fetch(&this->join_counter, -1);
+}
+
+
+// Called by the worker which has just enabled this node.  If the
+// heaviest input of this node was produced by some other worker,
+// posts the node to that worker's mailbox, adds the cell to posts,
+// and returns true.  Otherwise, returns false, and the caller should
+// spawn the node itself.
+bool StaticNabbitNode::post_to_producer(NabbitMailCell** posts) {
+  if (this->heaviest_pred == NULL) {
+    return false;
+  }
+  NabbitMailboxes* M = NabbitMailboxes::instance();
+  int target = this->heaviest_pred->producer_worker;
+  if ((target < 0) ||
+      (target >= M->get_num_workers()) ||
+      (target == GET_WORKER_ID)) {
+    return false;
+  }
+
+  NabbitMailCell* c = new NabbitMailCell(this);
+  c->poster_next = *posts;
+  *posts = c;
+  M->post(target, c);
+  return true;
 }
 
 
@@ -139,9 +361,81 @@ void StaticNabbitNode::source_compute(void) {
 }
 
 
+void* StaticNabbitNode::scratch(size_t bytes) {
+  assert(this->scratch_arena != NULL);
+  return this->scratch_arena->alloc(bytes);
+}
+
+
 /***************************************************************/
 // Methods which call Compute() and do bookkeepping.
 
+// Calls Compute(), with a scratch arena.
+void StaticNabbitNode::run_compute() {
+  {
+    NabbitScratchArena arena;
+    this->scratch_arena = &arena;
+    this->Compute();
+    this->scratch_arena = NULL;
+  }
+  this->producer_worker = GET_WORKER_ID;
+
+#ifdef NABBIT_MEMORY_AWARE
+  // No successor can start before we notify it.
+  this->pending_consumers = this->successors->size_estimate();
+  if (this->output_bytes > 0) {
+    NabbitMemoryBudget::instance()->add_live(this->output_bytes);
+  }
+  this->release_inputs();
+#endif
+}
+
+
+// Counts us out of the consumers of each predecessor's output, and
+// releases the outputs we were the last consumer of.
+void StaticNabbitNode::release_inputs() {
+  for (int i = 0; i < this->predecessors->size_estimate(); i++) {
+    StaticNabbitNode* pred = this->predecessors->get(i);
+    if ((pred->output_bytes > 0) &&
+	(__sync_add_and_fetch(&pred->pending_consumers, -1) == 0)) {
+      pred->ReleaseOutput();
+      NabbitMemoryBudget::instance()->release(pred->output_bytes);
+    }
+  }
+}
+
+// The bytes our Compute() frees (the outputs we are the last pending
+// consumer of), less the bytes of our own output.  Only a hint, since
+// other consumers may finish at the same time.
+long long StaticNabbitNode::bytes_freed_by_compute() {
+  long long freed = -this->output_bytes;
+  for (int i = 0; i < this->predecessors->size_estimate(); i++) {
+    StaticNabbitNode* pred = this->predecessors->get(i);
+    if ((pred->output_bytes > 0) && (pred->pending_consumers == 1)) {
+      freed += pred->output_bytes;
+    }
+  }
+  return freed;
+}
+
+// Sorts nodes by decreasing bytes_freed_by_compute().  n is at most
+// NABBIT_SPAWN_GRAIN, so insertion sort will do.
+void StaticNabbitNode::order_by_bytes_freed(StaticNabbitNode** nodes, int n) {
+  long long freed[NABBIT_SPAWN_GRAIN];
+  for (int k = 0; k < n; k++) {
+    StaticNabbitNode* v = nodes[k];
+    long long f = v->bytes_freed_by_compute();
+    int j = k;
+    while ((j > 0) && (freed[j-1] < f)) {
+      nodes[j] = nodes[j-1];
+      freed[j] = freed[j-1];
+      j--;
+    }
+    nodes[j] = v;
+    freed[j] = f;
+  }
+}
+
 void StaticNabbitNode::compute_and_notify() {
 
 #if NABBIT_PRINT_DEBUG == 1
@@ -149,34 +443,142 @@ void StaticNabbitNode::compute_and_notify() {
   	 this->key,
 	 cilk::current_worker_id());
 #endif
-  this->Compute();
-  
-  int end_to_notify = this->successors->size_estimate();
+  this->run_compute();
+
+#ifdef NABBIT_LOCALITY_PLACEMENT
+  // Run the nodes other workers have posted to us.
+  NabbitMailboxes* M = NabbitMailboxes::instance();
+  if ((this->producer_worker >= 0) &&
+      (this->producer_worker < M->get_num_workers())) {
+    NabbitMailCell* c = M->take_all(this->producer_worker);
+    while (c != NULL) {
+      NabbitMailCell* next = c->next;
+      if (c->claim()) {
+	cilk_spawn ((StaticNabbitNode*)c->item)->compute_and_notify();
+      }
+      c->release();
+      c = next;
+    }
+  }
+#endif
+
+  this->notify_successors(0, this->successors->size_estimate());
+  cilk_sync;
+}
+
+
+// Notifies successors [start, end).  Ranges larger than
+// NABBIT_SPAWN_GRAIN are split in half, so a node with d successors
+// spawns them all in O(log d) span.
+void StaticNabbitNode::notify_successors(int start, int end) {
+
+  while (end - start > NABBIT_SPAWN_GRAIN) {
+    int mid = start + (end - start) / 2;
+    cilk_spawn this->notify_successors(start, mid);
+    start = mid;
+  }
+
+  int end_to_notify = end;
+  int num_enabled = 0;
+
+#ifdef NABBIT_LOCALITY_PLACEMENT
+  // The nodes we posted to other workers.
+  NabbitMailCell* posts = NULL;
+#endif
+
+#ifdef NABBIT_MEMORY_AWARE
+  // The successors we enabled, which we run once we know which of
+  // them frees the most memory.
+  StaticNabbitNode* held[NABBIT_SPAWN_GRAIN];
+  int num_held = 0;
+#endif
+
+#if NABBIT_PREFETCH_DISTANCE > 0
+  // A successor enabled on the previous iteration.  We spawn it right
+  // after one more notification, so its inputs have time to arrive.
+  StaticNabbitNode* enabled_succ = NULL;
+
+  for (int i = start; (i < start + NABBIT_PREFETCH_DISTANCE) && (i < end_to_notify); i++) {
+    NABBIT_PREFETCH_WRITE(&this->successors->get(i)->join_counter);
+  }
+#endif
 
   // Handle the current range of values in the blocking array.
-  //    cilk_for (int i = this->notify_counter; i < end_to_notify; i++) {
-  for (int i = 0; i < end_to_notify; i++) {
+  for (int i = start; i < end_to_notify; i++) {
+
+#if NABBIT_PREFETCH_DISTANCE > 0
+    if (i + NABBIT_PREFETCH_DISTANCE < end_to_notify) {
+      NABBIT_PREFETCH_WRITE(&this->successors->get(i + NABBIT_PREFETCH_DISTANCE)->join_counter);
+    }
+#endif
 
     StaticNabbitNode* current_succ = this->successors->get(i);
-    if (current_succ->join_counter <= 0) {
-      printf("ERROR: this key = %llu, current_succ = %p (key = %llu), join coutner = %d\n",
-	     this->key,
-	     current_succ, current_succ->key,
-	     current_succ->join_counter);
+    int updated_val = current_succ->decrement_join_counter(this);
+
+#if NABBIT_PREFETCH_DISTANCE > 0
+    if (enabled_succ != NULL) {
+      cilk_spawn enabled_succ->compute_and_notify();
+      enabled_succ = NULL;
     }
-    assert(current_succ->join_counter > 0);
-    int updated_val = __sync_add_and_fetch(&current_succ->join_counter,
-					   -1);
+#endif
 
     if (updated_val == 0) {
+      num_enabled++;
+      NABBIT_ELASTIC_NOTE_READY(num_enabled);
 #if NABBIT_PRINT_DEBUG == 1
       printf("Worker %d enabling current_pred with key = %llu.\n",
 	     cilk::current_worker_id(),
 	     current_succ->key);
 #endif
+#ifdef NABBIT_LOCALITY_PLACEMENT
+      if (current_succ->post_to_producer(&posts)) {
+	continue;
+      }
+#endif
+#if defined(NABBIT_MEMORY_AWARE)
+      current_succ->PrefetchInputs();
+      held[num_held++] = current_succ;
+#elif NABBIT_PREFETCH_DISTANCE > 0
+      current_succ->PrefetchInputs();
+      enabled_succ = current_succ;
+#else
       cilk_spawn current_succ->compute_and_notify();
+#endif
     }
   }
+
+#ifdef NABBIT_MEMORY_AWARE
+  // The first spawn runs on this worker, so we go depth-first along
+  // the successor which frees the most.  Over the soft cap, we run
+  // the successors one at a time instead, and start no new branches.
+  order_by_bytes_freed(held, num_held);
+  for (int k = 0; k < num_held; k++) {
+    if (NabbitMemoryBudget::instance()->over_cap()) {
+      held[k]->compute_and_notify();
+    }
+    else {
+      cilk_spawn held[k]->compute_and_notify();
+    }
+  }
+#endif
+
+#if NABBIT_PREFETCH_DISTANCE > 0
+  if (enabled_succ != NULL) {
+    cilk_spawn enabled_succ->compute_and_notify();
+  }
+#endif
+
+#ifdef NABBIT_LOCALITY_PLACEMENT
+  // Run whatever the other workers have not taken yet.
+  while (posts != NULL) {
+    NabbitMailCell* c = posts;
+    posts = c->poster_next;
+    if (c->claim()) {
+      cilk_spawn ((StaticNabbitNode*)c->item)->compute_and_notify();
+    }
+    c->release();
+  }
+#endif
   cilk_sync;
 }
 
@@ -31,18 +31,23 @@
 
 #include <dag_status.h>
 #include <dynamic_array.h>
+#include <nabbit_inline_array.h>
+#include <nabbit_node_layout.h>
+#include <nabbit_scratch_arena.h>
 
 // Debugging flag.
 //#define NABBIT_PRINT_DEBUG 1
 
 class StaticSerialNode;
-typedef DynamicArray<StaticSerialNode*> StaticSerialNodeArray;
+typedef NabbitInlineArray<StaticSerialNode*, NABBIT_INLINE_DEGREE> StaticSerialNodeArray;
 
 
 class StaticSerialNode {
 
  public:
   long long key;
+  // Point at pred_storage and succ_storage once the node is
+  // initialized.
   StaticSerialNodeArray* predecessors;
   StaticSerialNodeArray* successors;
   //  StaticSerialNodeArray* children;
@@ -60,14 +65,28 @@ class StaticSerialNode {
   void add_dep(StaticSerialNode* child);
   
   void add_child(StaticSerialNode* child);
+
+  // The serial node runs everything on one worker, so it ignores
+  // edge weights (see nabbit_placement.h).
+  void add_dep(StaticSerialNode* dep_node, long long input_bytes);
+  void add_child(StaticSerialNode* dep_node, long long input_bytes);
   void source_compute();
   
  protected:
   virtual void InitNode() = 0;
   virtual void Compute() = 0;
 
+  // Temporary memory for the current call to Compute().  It is freed
+  // automatically when Compute() returns.  Only call this from the
+  // Compute() strand itself (see nabbit_scratch_arena.h).
+  void* scratch(size_t bytes);
+
  private:
+  // Only set while Compute() is running.
+  NabbitScratchArena* scratch_arena;
   volatile int join_counter; 
+  StaticSerialNodeArray pred_storage;
+  StaticSerialNodeArray succ_storage;
   void compute_and_notify();
 
 };
@@ -81,33 +100,33 @@ class StaticSerialNode {
 StaticSerialNode::StaticSerialNode(long long k) 
   :  key(k),
      predecessors(NULL),
-     successors(NULL) {
+     successors(NULL),
+     scratch_arena(NULL) {
 }
 
 StaticSerialNode::StaticSerialNode(long long k, int num_predecessors) 
   :  key(k),
      predecessors(NULL),
-     successors(NULL) {
+     successors(NULL),
+     scratch_arena(NULL) {
 }
 
      
 StaticSerialNode::~StaticSerialNode() {
-  if (this->predecessors) {
-    delete this->predecessors;
-  }
-  if (this->successors != NULL) {
-    delete this->successors;
-  }
 }
 
 
 /***************************************************************/
 // Methods for constructing the dag statically. 
 
+// The first NABBIT_INLINE_DEGREE edges in each direction are stored
+// in the node itself, so default_degree is only a hint.
 void StaticSerialNode::init_node(int default_degree) {
 
-  this->predecessors = new StaticSerialNodeArray(default_degree);
-  this->successors = new StaticSerialNodeArray(default_degree);
+  this->pred_storage.clear();
+  this->succ_storage.clear();
+  this->predecessors = &this->pred_storage;
+  this->successors = &this->succ_storage;
   this->join_counter = 0;
   //  this->children = this->predecessors;
 
@@ -137,12 +156,28 @@ void StaticSerialNode::add_child(StaticSerialNode* dep_node) {
   this->join_counter++;
 }
 
+void StaticSerialNode::add_dep(StaticSerialNode* dep_node,
+			       long long input_bytes) {
+  this->add_dep(dep_node);
+}
+
+void StaticSerialNode::add_child(StaticSerialNode* dep_node,
+				 long long input_bytes) {
+  this->add_child(dep_node);
+}
+
 
 void StaticSerialNode::source_compute(void) {
   this->compute_and_notify();
 }
 
 
+void* StaticSerialNode::scratch(size_t bytes) {
+  assert(this->scratch_arena != NULL);
+  return this->scratch_arena->alloc(bytes);
+}
+
+
 /***************************************************************/
 // Methods which call Compute() and do bookkeepping.
 
@@ -153,14 +188,31 @@ void StaticSerialNode::compute_and_notify() {
   	 this->key,
 	 cilk::current_worker_id());
 #endif
-  this->Compute();
+  {
+    NabbitScratchArena arena;
+    this->scratch_arena = &arena;
+    this->Compute();
+    this->scratch_arena = NULL;
+  }
   
   int end_to_notify = this->successors->size_estimate();
 
+#if NABBIT_PREFETCH_DISTANCE > 0
+  for (int i = 0; (i < NABBIT_PREFETCH_DISTANCE) && (i < end_to_notify); i++) {
+    NABBIT_PREFETCH_WRITE(&this->successors->get(i)->join_counter);
+  }
+#endif
+
   // Handle the current range of values in the blocking array.
   //    cilk_for (int i = this->notify_counter; i < end_to_notify; i++) {
   for (int i = 0; i < end_to_notify; i++) {
 
+#if NABBIT_PREFETCH_DISTANCE > 0
+    if (i + NABBIT_PREFETCH_DISTANCE < end_to_notify) {
+      NABBIT_PREFETCH_WRITE(&this->successors->get(i + NABBIT_PREFETCH_DISTANCE)->join_counter);
+    }
+#endif
+
     StaticSerialNode* current_succ = this->successors->get(i);
     if (current_succ->join_counter <= 0) {
       printf("ERROR: this key = %llu, current_succ = %p (key = %llu), join coutner = %d\n",
@@ -28,13 +28,82 @@
 #ifndef __TASK_GRAPH_HASH_TABLE_H_
 #define __TASK_GRAPH_HASH_TABLE_H_
 
+#include <nabbit_slab_allocator.h>
+
+class NabbitEpochReclaimer;
 
 class TaskGraphHashTable {
 
  public:
+  // If this is not NULL, dynamic Nabbit nodes stored in the table
+  // release their memory once they are COMPLETED and all their
+  // successors have finished reading them.  See
+  // dynamic_nabbit_node.h.
+  NabbitEpochReclaimer* reclaimer;
+
+#ifdef NABBIT_DISABLE_SLAB_ALLOCATOR
+  TaskGraphHashTable() : reclaimer(NULL), slab(NULL) { }
+#else
+  TaskGraphHashTable()
+    : reclaimer(NULL),
+      slab(new NabbitSlabAllocator(__cilkrts_get_nworkers())) { }
+#endif
+
+  void set_reclaimer(NabbitEpochReclaimer* r) {
+    this->reclaimer = r;
+  }
+
+  // The slab allocator for this graph.  Nodes can come from here
+  // (e.g., "new (H->get_slab()) MyNode(k, H)"), along with what the
+  // dynamic nodes allocate for themselves (successor cells,
+  // predecessor arrays, combining counters) and DynamicArrays created
+  // with this pool.  All of it is returned to the system at once
+  // when the table is destroyed.  Anything else, e.g., the nodes of
+  // a separate hash table which stores the tasks, comes from the
+  // default allocator, and is not released with the graph.  NULL if
+  // the slab allocator is disabled, which nabbit_slab_alloc() treats
+  // as malloc.
+  NabbitSlabAllocator* get_slab() {
+    return this->slab;
+  }
+
   virtual void* get_task(long long key) = 0;
   virtual int insert_task_if_absent(long long key) = 0;
 
+  // Returns the task for key, creating it if it is not there yet.
+  // Sets *inserted to 1 if this call created the task (and should
+  // therefore expand it), and to 0 otherwise.
+  //
+  // The default implementation just retries get_task and
+  // insert_task_if_absent.  Tables that can find (or create) a
+  // task with a single probe should override this method.
+  virtual void* get_or_insert_task(long long key, int* inserted) {
+    void* task = get_task(key);
+    *inserted = 0;
+    while (!task) {
+      *inserted = insert_task_if_absent(key);
+      task = get_task(key);
+    }
+    return task;
+  }
+
+  // Called by a reclaimed dynamic Nabbit node, just before it is
+  // deleted (see dynamic_nabbit_node.h).  Tables which delete their
+  // tasks when they are destroyed must forget the task for key here.
+  // Nothing looks the key up again, since every successor of the node
+  // has already found it.
+  virtual void remove_task(long long key) { }
+
+  // Subclasses must delete their nodes in their own destructors,
+  // which run before this one releases the slabs.
+  virtual ~TaskGraphHashTable() {
+    if (this->slab) {
+      delete this->slab;
+    }
+  }
+
+ private:
+  NabbitSlabAllocator* slab;
 };
 
 
@@ -0,0 +1,149 @@
+// Code for the Nabbit task graph library
+//
+// Copyright (c) 2010 Jim Sukha
+//
+//
+/*
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use, copy,
+ * modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+
+#ifndef __HASH_TABLE_TEST_H
+#define __HASH_TABLE_TEST_H
+
+// Insert and lookup tests shared by the tests of the hash tables
+// which can replace ConcurrentHashTable.  HashTable must provide
+// search(), insert_if_absent(), get_keys() and print_table().
+//
+// The value stored for key k is k+1, since some tables do not allow
+// NULL values.
+
+#include <stdint.h>
+
+#include "qsort.h"
+
+
+static inline void* hash_test_value(long long k) {
+  return (void*)(intptr_t)(k + 1);
+}
+
+
+// Checks that every key in [0, R-1] appears exactly once, and maps
+// to the value we inserted for it.
+template <class HashTable>
+bool check_hash_insert(HashTable* H, int R) {
+  long long final_size;
+  long long* a = H->get_keys(&final_size);
+
+  sample_qsort(a, a+final_size);
+
+  assert(final_size == R);
+  for (int i = 0; i < R; i++) {
+    LOpStatus code;
+    assert(a[i] == i);
+    void* v = H->search(i, &code);
+    assert(code == OP_FOUND);
+    assert(v == hash_test_value(i));
+  }
+
+  delete [] a;
+  return true;
+}
+
+
+// Tries to insert elements [0, 1, .. R-1] into the table.
+template <class HashTable>
+void all_hash_insert(HashTable* H, int R) {
+
+  int statusCounts[OP_LAST];
+
+  for (int i = OP_NULL; i < OP_LAST; i++) {
+    statusCounts[i] = 0;
+  }
+
+  for (int i = 0; i < R; i++) {
+    LOpStatus code = OP_FAILED;
+    void* return_val;
+
+    // Retry insert until return code is not OP_FAILED.
+    while (code == OP_FAILED) {
+      return_val = H->insert_if_absent(i,
+				       hash_test_value(i),
+				       &code);
+      statusCounts[code]++;
+    }
+    assert(return_val == hash_test_value(i));
+  }
+
+  printf("Final code results: ");
+  for (int i = OP_NULL; i < OP_LAST; i++) {
+    printf("(%d, %d)  ",
+	   i, statusCounts[i]);
+  }
+  printf("\n");
+}
+
+
+// Tries to insert n random elements into H, with each element being
+// chosen uniformly from the range [0 .. R-1].
+template <class HashTable>
+void test_hash_insert(HashTable* H, int R, int n) {
+
+  for (int i = 0; i < n; i++) {
+    int rand_num = rand() % R;
+    LOpStatus code = OP_FAILED;
+    void* return_val;
+
+    while (code == OP_FAILED) {
+      return_val = H->insert_if_absent(rand_num,
+				       hash_test_value(rand_num),
+				       &code);
+    }
+    assert(return_val == hash_test_value(rand_num));
+  }
+}
+
+
+// Runs 20 parallel streams of random inserts, then inserts and
+// checks every key in [0, R-1].
+template <class HashTable>
+void run_hash_table_test(HashTable* H, int R) {
+  long start_time = example_get_time();
+  for (int i = 0; i < 20; i++) {
+    cilk_spawn test_hash_insert(H, R, R/20);
+  }
+  cilk_sync;
+  long end_time = example_get_time();
+  printf("** Running time of %d hash insert attempts: %f seconds **\n ",
+	 20 * (int)(R/20),
+	 (end_time-start_time) / 1000.f);
+
+  all_hash_insert(H, R);
+  check_hash_insert(H, R);
+
+  if (R <= 100) {
+    printf("Final hash table\n");
+    H->print_table();
+  }
+}
+
+
+#endif
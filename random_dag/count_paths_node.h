@@ -83,7 +83,7 @@ class DetPathsDAGNode: public DAGNode<NodeType> {
 					   bool verbose);
 
  private:
-  DynamicArray<NodeType* >* children;
+  NabbitInlineArray<NodeType*, NABBIT_INLINE_DEGREE>* children;
   //  DynamicArray<DetPathsDAGNode*>* children;  
   void assert_precompute_status(void);
 };
@@ -274,7 +274,7 @@ void DetPathsDAGNode<NodeType>::GenerateTestDag(CountPathDAGParams* params) {
   }
 
   //  GenerateChildrenMap(params);
-  params->sdag_map = new ConcurrentHashTable(10 + params->MAX_DAG_ID / 100);
+  params->sdag_map = new DAGNodeHashTable(DAG_NODE_HASH_TABLE_SIZE(params->MAX_DAG_ID));
 
   int num_nodes = 0;
   int num_edges = 0;
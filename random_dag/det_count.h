@@ -40,6 +40,28 @@
 #include <concurrent_hash_table.h>
 
 
+// The table which maps keys to dag nodes (params->sdag_map).
+// Compile with -DUSE_OPEN_ADDRESS_HASH_TABLE to use the open
+// addressing table instead of the chained ConcurrentHashTable.  The
+// open addressing table does not resize, so it needs one slot per
+// node up front.
+//
+// Compile with -DUSE_SPLIT_ORDERED_HASH_TABLE to use a table which
+// grows as nodes are inserted, starting from a small initial size.
+#if defined(USE_OPEN_ADDRESS_HASH_TABLE)
+#include <open_address_hash_table.h>
+typedef OpenAddressHashTable DAGNodeHashTable;
+#define DAG_NODE_HASH_TABLE_SIZE(max_dag_id) ((max_dag_id) + 1)
+#elif defined(USE_SPLIT_ORDERED_HASH_TABLE)
+#include <split_ordered_hash_table.h>
+typedef SplitOrderedHashTable DAGNodeHashTable;
+#define DAG_NODE_HASH_TABLE_SIZE(max_dag_id) (16)
+#else
+typedef ConcurrentHashTable DAGNodeHashTable;
+#define DAG_NODE_HASH_TABLE_SIZE(max_dag_id) (10 + (max_dag_id) / 100)
+#endif
+
+
 #define MAX(a, b) (((a) > (b)) ? (a) : (b))
 
 const int LargePrime = 251700653;
@@ -70,7 +92,7 @@ struct CountPathDAGParams {
   DynamicArray<long long>* root_keys;
 
   // Stores the nodes of the dag.
-  ConcurrentHashTable* sdag_map;
+  DAGNodeHashTable* sdag_map;
   void* dynamicHashTable;
 
   // Stores lists of children for each index. 
@@ -79,6 +101,15 @@ struct CountPathDAGParams {
   // Stores keys to randomly generate for each child.
   ConcurrentHashTable* gen_map;
   
+  // If true, dynamic Nabbit nodes are reclaimed once all their
+  // parents have computed.
+  bool reclaim_nodes;
+
+  // Only used if reclaim_nodes is true.  A node saves its result
+  // here before it is deleted, so we can still check it at the end.
+  int* reclaimed_results;
+  bool* is_reclaimed;
+
   bool use_random_online_map;
   int num_nodes;
   int num_edges;
@@ -442,6 +473,70 @@ static bool CheckResult(CountNode* root,
 
 
 
+// The same check as CheckResult, for a run which reclaimed every node
+// except the root.  The nodes are gone, so we walk
+// params->children_map, and read the saved results instead.
+template <class CountNode>
+static bool CheckReclaimedResult(CountNode* root,
+				 bool verbose) {
+  CountPathDAGParams* params = root->params;
+  int num_nodes = 0;
+  int num_edges = 0;
+  int max_dag_id = params->MAX_DAG_ID;
+
+  assert(params->reclaimed_results && params->is_reclaimed);
+
+  for (int k = max_dag_id; k >= 0; k--) {
+    LOpStatus code = OP_FAILED;
+    ConcurrentLinkedList* child_list = NULL;
+    while (code == OP_FAILED) {
+      child_list = (ConcurrentLinkedList*)params->children_map->search(k,
+								       &code);
+    }
+    if (child_list != NULL) {
+      int test_result = (k == max_dag_id ? 1 : 0);
+      num_nodes++;
+
+      ListNode* c = child_list->get_list_head();
+      while (c != NULL) {
+	assert(c->hashkey > k);
+	assert(params->is_reclaimed[c->hashkey]);
+	test_result += params->reclaimed_results[c->hashkey];
+	num_edges++;
+	c = c->next;
+      }
+      test_result += DetCountWork(params, k);
+
+      int n_result;
+      if (k == root->key) {
+	n_result = root->result;
+      }
+      else {
+	assert(params->is_reclaimed[k]);
+	n_result = params->reclaimed_results[k];
+      }
+      if (test_result != n_result) {
+	printf("ERROR: checking reclaimed node %d, test_result = %d, result = %d\n",
+	       k, test_result, n_result);
+      }
+      assert(test_result == n_result);
+    }
+  }
+
+  if (verbose) {
+    printf("Number of nodes = %d. Number of edges = %d\n",
+	   num_nodes, num_edges);
+  }
+  assert(num_nodes == params->num_nodes);
+  assert(num_edges == params->num_edges);
+
+  if (verbose) {
+    printf("Final result: CORRECT\n");
+  }
+  return true;
+}
+
+
 template<class CountNode>
 static void SerialVisitDag(CountNode* current_root,
 			   ConcurrentHashTable* node_check_map) {
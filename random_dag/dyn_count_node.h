@@ -55,13 +55,15 @@ template <class DynNodeType>
 class DynPathHashTable: public TaskGraphHashTable {
 
  public:  
-  ConcurrentHashTable* H;  
+  DAGNodeHashTable* H;  
 
-  DynPathHashTable(ConcurrentHashTable* H_);
+  DynPathHashTable(DAGNodeHashTable* H_);
 
   void* get_task(long long key);
   
   int insert_task_if_absent(long long key);
+
+  void* get_or_insert_task(long long key, int* inserted);
 };
 
 
@@ -76,6 +78,9 @@ class DynPathCountNode: public DynNodeType {
   int result;
   int path_length;
 
+  // The number of nodes which have this node as a child.
+  int num_parents;
+
   DynPathCountNode(long long k,
 		   CountPathDAGParams* params,
 		   DynPathHashTable<DynNodeType>* H);
@@ -83,6 +88,7 @@ class DynPathCountNode: public DynNodeType {
   void Init();
   void Compute();
   void Generate();
+  void Reclaim();
 
   
  public:
@@ -106,12 +112,14 @@ class DynPathCountNode: public DynNodeType {
   // node has value of 1).
   friend bool CheckResult<DynPathCountNode>(DynPathCountNode* root,
 					    bool verbose);
+  friend bool CheckReclaimedResult<DynPathCountNode>(DynPathCountNode* root,
+						     bool verbose);
 
 };
 
 
 template <class DynNodeType>
-DynPathHashTable<DynNodeType>::DynPathHashTable(ConcurrentHashTable* H_):
+DynPathHashTable<DynNodeType>::DynPathHashTable(DAGNodeHashTable* H_):
   H(H_) {
 }
 
@@ -177,7 +185,32 @@ int DynPathHashTable<DynNodeType>::insert_task_if_absent(long long key) {
 }
 
 
+// All the nodes are already in H, so getting or inserting a node only
+// needs one search, plus a CAS to mark the node as visited.
+template <class DynNodeType>
+void* DynPathHashTable<DynNodeType>::get_or_insert_task(long long key,
+							int* inserted) {
+  DynPathCountNode<DynNodeType>* n = NULL;
+  LOpStatus code = OP_FAILED;
+  bool success = false;
+  while (code == OP_FAILED) {
+    n = (DynPathCountNode<DynNodeType>*)H->search(key,
+						  &code);
+  }
+  assert(n != NULL);
+
+  while (n->get_status() == NODE_UNVISITED) {
+    success = n->try_mark_as_visited();
+  }
+
+#if PRINT_DEBUG_STATEMENTS == 1
+  printf("HASH get or insert on key %llu. inserted = %d\n",
+	 key, success);
+#endif
 
+  *inserted = success ? 1 : 0;
+  return (void*)n;
+}
 
 
 // Creates a root node for the dag.
@@ -186,7 +219,8 @@ DynPathCountNode<DynNodeType>::DynPathCountNode(CountPathDAGParams *params,
 						DynPathHashTable<DynNodeType>* H)
   : DynNodeType(0, H),
     params(params),
-    children(NULL) {
+    children(NULL),
+    num_parents(0) {
 }
 
 template <class DynNodeType>
@@ -195,7 +229,8 @@ DynPathCountNode<DynNodeType>::DynPathCountNode(long long k,
 						DynPathHashTable<DynNodeType>* H)
   : DynNodeType(k, H),
     params(params),
-    children(NULL) {
+    children(NULL),
+    num_parents(0) {
 }
 
 
@@ -209,6 +244,11 @@ void DynPathCountNode<DynNodeType>::Init() {
   this->result = 0;
   this->path_length = 0;
 
+  // The root holds the final answer, so we keep it.
+  if (params->reclaim_nodes && (this->key != 0)) {
+    this->set_successor_count(this->num_parents);
+  }
+
   for (i = 0; i < this->children->size_estimate(); ++i) {
     DynPathCountNode<DynNodeType>* child = (DynPathCountNode<DynNodeType>*)this->children->get(i);
     add_dep(child->key);
@@ -261,6 +301,16 @@ void DynPathCountNode<DynNodeType>::Compute() {
 }
 
 
+// Saves the result for CheckReclaimedResult, since the node is about
+// to be deleted.
+template <class DynNodeType>
+void DynPathCountNode<DynNodeType>::Reclaim() {
+  params->reclaimed_results[this->key] = this->result;
+  params->is_reclaimed[this->key] = true;
+  delete this->children;
+  this->children = NULL;
+}
+
 template <class DynNodeType>
 int DynPathCountNode<DynNodeType>::GetResult() {
   return this->result;
@@ -318,7 +368,7 @@ void DynPathCountNode<DynNodeType>::GenerateTestDag(CountPathDAGParams* params)
   }
 
   //  GenerateChildrenMap(params);
-  params->sdag_map = new ConcurrentHashTable(10 + params->MAX_DAG_ID / 100);
+  params->sdag_map = new DAGNodeHashTable(DAG_NODE_HASH_TABLE_SIZE(params->MAX_DAG_ID));
   params->dynamicHashTable = (void*) new DynPathHashTable<DynNodeType>(params->sdag_map);
   assert(params->dynamicHashTable);
 
@@ -337,10 +387,12 @@ void DynPathCountNode<DynNodeType>::GenerateTestDag(CountPathDAGParams* params)
     }
 
     if (current_list != NULL) {
-      current_node = new DynPathCountNode<DynNodeType>(k, params,
-						       (DynPathHashTable<DynNodeType>*)params->dynamicHashTable);
+      DynPathHashTable<DynNodeType>* table = (DynPathHashTable<DynNodeType>*)params->dynamicHashTable;
+      current_node = new (table->get_slab()) DynPathCountNode<DynNodeType>(k, params,
+									   table);
       // Create the children array.
-      current_node->children = new DynamicArray<DynPathCountNode<DynNodeType>*>(2);
+      current_node->children =
+	new (table->get_slab()) DynamicArray<DynPathCountNode<DynNodeType>*>(2, table->get_slab());
       num_nodes++;
       
       LOpStatus n_code = OP_FAILED;
@@ -369,6 +421,7 @@ void DynPathCountNode<DynNodeType>::GenerateTestDag(CountPathDAGParams* params)
 	assert(child_node != NULL);
 
 	current_node->children->add(child_node);
+	child_node->num_parents++;
 	num_edges++;
 
 	c = c->next;
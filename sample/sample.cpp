@@ -42,6 +42,7 @@
 typedef enum {
   TEST_SERIAL = 0,
   TEST_STATIC_NABBIT = 1,
+  TEST_STATIC_NABBIT_REDUCE = 2,
   TEST_ALL,
 } SampleTestType;
 
@@ -51,8 +52,8 @@ typedef enum {
 //
 // The value of each node is its key + the values of its
 // immediate predecessors.
-template <class NodeType>
-void create_static_DAG(SampleDAGNode<NodeType>* nodes, int n) {
+template <class DAGNodeType>
+void create_static_DAG(DAGNodeType* nodes, int n) {
   assert(n <= SAMPLE_DAG_SIZE);
   for (int i = 0; i < n; i++) {
     nodes[i].key = i;
@@ -97,6 +98,14 @@ void run_test(SampleTestType test_type) {
       assert(nodes[0].result == 55);
     }
     break;    
+  case TEST_STATIC_NABBIT_REDUCE:
+    {
+      SampleReduceDAGNode nodes[SAMPLE_DAG_SIZE];
+      create_static_DAG(nodes, SAMPLE_DAG_SIZE);
+      nodes[SAMPLE_DAG_SIZE-1].source_compute();
+      assert(nodes[0].result == 55);
+    }
+    break;
   default:
     printf("No test type %d\n", test_type);
     assert(0);
@@ -31,6 +31,7 @@
 #define __SAMPLE_DAG_NODE_H
 
 #include <dag_node.h>
+#include <nabbit_reduction_node.h>
 
 const int SAMPLE_DAG_SIZE = 10;
 
@@ -85,4 +86,52 @@ void SampleDAGNode<NodeType>::Compute() {
 }
 
 
+// The same node, as a reduction node: each predecessor adds its
+// result into a per-worker partial as soon as it finishes, so
+// Compute() only merges the partials.
+class SampleReduceDAGNode: public StaticReductionNode<NabbitSumMonoid<int> > {
+
+ private:
+  void InitNode();
+  void Compute();
+  int PredecessorValue(StaticNabbitNode* pred);
+
+ public:
+  SampleReduceDAGNode();
+  void* params;
+  int result;
+};
+
+
+SampleReduceDAGNode::SampleReduceDAGNode()
+  : StaticReductionNode<NabbitSumMonoid<int> >(0, 3),
+    params(NULL) {
+}
+
+void SampleReduceDAGNode::InitNode() {
+  if (this->key < SAMPLE_DAG_SIZE-1) {
+    this->result = (int)this->key;
+  }
+  else {
+    // Source node has no value associated with it.
+    this->result = 0;
+  }
+  printf("InitNode with key %llu: initialized result to %d\n",
+	 this->key,
+	 this->result);
+}
+
+int SampleReduceDAGNode::PredecessorValue(StaticNabbitNode* pred) {
+  return ((SampleReduceDAGNode*)pred)->result;
+}
+
+void SampleReduceDAGNode::Compute() {
+  this->result += this->reduced_value();
+
+  printf("At key %llu: computed value %d\n",
+	 this->key,
+	 this->result);
+}
+
+
 #endif
@@ -54,6 +54,7 @@ class SWDAGNode: public NodeType {
   
   void InitNode();
   void Compute();
+  void PrefetchInputs();
 
 #ifdef TRACK_THREAD_CPU_IDS  
   // int init_id;
@@ -113,6 +114,13 @@ void SWDAGNode<StaticNabbitNode>::Compute() {
 }
 
 
+// Only the parallel node types call this.
+template <class NodeType>
+void SWDAGNode<NodeType>::PrefetchInputs() {
+  params->PrefetchAtKey(this->key);
+}
+
+
 template <class NodeType>
 int SWDAGNode<NodeType>::GetResult() {
   return this->result;
@@ -33,6 +33,7 @@
 
 #include <array2d_base.h>
 #include <array2d_morton.h>
+#include <nabbit_node_layout.h>
 #include "sw_matrix_kernels.h"
 
 #define RANDOM_CHILD_ORDER 0
@@ -86,6 +87,7 @@ class SWDAGParams {
 		     bool make_copy);
 
   int ComputeAtKey(long long key);
+  void PrefetchAtKey(long long key);
 
   SWNodeType* ConstructBlockDAG(void);
   void CheckResult();
@@ -145,6 +147,40 @@ void SWDAGParams<SWNodeType>::InitGammaAndS(int* gamma,
   }
 }
 
+// Prefetches the halo that ComputeAtKey(key) reads: the last row of
+// the block above, and the last column of the block to the left.
+//
+// A 64-byte cache line holds a 4x4 tile of a Morton-ordered int
+// array, so we only touch every 4th element along the halo.
+template <class SWNodeType>
+void SWDAGParams<SWNodeType>::PrefetchAtKey(long long key) {
+  SWDAGParams<SWNodeType>* params = this;
+
+  int row_num = MortonIndexing::get_row(key);
+  int col_num = MortonIndexing::get_col(key);
+  if ((row_num == 0) || (col_num == 0)) {
+    return;
+  }
+
+  int start_row = 1 + (row_num - 1) * params->Bheight;
+  int end_row = start_row + params->Bheight;
+  int start_col = 1 + (col_num - 1) * params->Bwidth;
+  int end_col = start_col + params->Bwidth;
+  if (end_row > params->height+1) {
+    end_row = params->height+1;
+  }
+  if (end_col > params->width+1) {
+    end_col = params->width+1;
+  }
+
+  for (int q = start_col - 1; q < end_col; q += 4) {
+    NABBIT_PREFETCH_READ(params->data->get_ptr(start_row - 1, q));
+  }
+  for (int q = start_row; q < end_row; q += 4) {
+    NABBIT_PREFETCH_READ(params->data->get_ptr(q, start_col - 1));
+  }
+}
+
 template <class SWNodeType>
 int SWDAGParams<SWNodeType>::ComputeAtKey(long long key) {
   
@@ -252,6 +288,12 @@ SWNodeType* SWDAGParams<SWNodeType>::ConstructBlockDAG(void) {
 #endif
   params->data = new NabbitArray2DMorton<int, 0>(params->width+1,
 						 params->height+1);
+#ifdef NABBIT_NUMA_PLACEMENT
+  // Nothing has touched the data yet, so each socket can get the
+  // pages of its part of the Morton order (see nabbit_numa.h).
+  nabbit_numa_place(params->data->get_data(),
+		    params->data->get_total_size());
+#endif
 
 #ifdef DEBUG_PRINT
   printf("final_col_blocks is %d, final_row_blocks is %d\n",
@@ -270,7 +312,9 @@ SWNodeType* SWDAGParams<SWNodeType>::ConstructBlockDAG(void) {
     printf("Block_dag_size is %llu \n",
 	   block_dag_size);
 #endif
-    params->block_data = new SWNodeType[block_dag_size];
+    // Neighbouring blocks usually finish on different workers, so
+    // the nodes go in a cache-aligned array (see nabbit_node_layout.h).
+    params->block_data = nabbit_alloc_node_array<SWNodeType>(block_dag_size);
 
 #ifdef DEBUG_PRINT
     printf("Done with allocation of dag nodes\n");
@@ -287,6 +331,11 @@ SWNodeType* SWDAGParams<SWNodeType>::ConstructBlockDAG(void) {
     }
   }
 
+  // A block reads the last column of its left neighbour, and the
+  // last row of its upper neighbour.
+  long long left_input_bytes = params->Bheight * sizeof(int);
+  long long upper_input_bytes = params->Bwidth * sizeof(int);
+
   // Creating the DAG nodes for each of the blocks.
   for (int bi = 0; bi < final_row_blocks; bi++) {
     for (int bj = 0; bj < final_col_blocks; bj++) {
@@ -311,23 +360,23 @@ SWNodeType* SWDAGParams<SWNodeType>::ConstructBlockDAG(void) {
 	if (bj > 0) {
 	  long long child_idx = MortonIndexing::get_idx(bi, bj-1);
 	  child = &(tmp_data[child_idx]);
-	  current_node->add_child(child);
+	  current_node->add_child(child, left_input_bytes);
 	}
 	if (bi > 0) {
 	  long long child_idx = MortonIndexing::get_idx(bi-1, bj);
 	  child = &(tmp_data[child_idx]);
-	  current_node->add_child(child);
+	  current_node->add_child(child, upper_input_bytes);
 	}
       } else {
 	if (bi > 0) {
 	  long long child_idx = MortonIndexing::get_idx(bi-1, bj);
 	  child = &(tmp_data[child_idx]);
-	  current_node->add_child(child);
+	  current_node->add_child(child, upper_input_bytes);
 	}
 	if (bj > 0) {
 	  long long child_idx = MortonIndexing::get_idx(bi, bj-1);
 	  child = &(tmp_data[child_idx]);
-	  current_node->add_child(child);
+	  current_node->add_child(child, left_input_bytes);
 	}	
       }
     }
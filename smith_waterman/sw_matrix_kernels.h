@@ -132,12 +132,12 @@ void sw_compute_base(SMatrixType* s,
 #ifdef TRACK_THREAD_CPU_IDS
   NabbitNodeRecord<SWRec> node_rec;
   if (sw_global_stats->is_collecting()) {
-    NabbitTimers::cycleCounter(&node_rec.start_ts);
     node_rec.data.start_i = start_row;
     node_rec.data.end_i = end_row;
     node_rec.data.start_j = start_col;
     node_rec.data.end_j = end_col;
-    node_rec.compute_id = cilk::current_worker_id();
+    sw_global_stats->start_noderec(&node_rec,
+				   cilk::current_worker_id());
   }
 #endif
 
@@ -168,8 +168,7 @@ void sw_compute_base(SMatrixType* s,
 
 #ifdef TRACK_THREAD_CPU_IDS
   if (sw_global_stats->is_collecting()) {
-    NabbitTimers::cycleCounter(&node_rec.end_ts);
-    sw_global_stats->add_noderec(&node_rec);
+    sw_global_stats->finish_noderec(&node_rec);
   }
 #endif  
 }